@@ -166,8 +166,10 @@ static void mmc5_PPUWrite(uint32 A, uint8 V) {
 		if (PPUCHRRAM & (1 << (tmp >> 10)))
 			VPage[tmp >> 10][tmp] = V;
 	} else {
-		if (PPUNTARAM & (1 << ((tmp & 0xF00) >> 10)))
+		if (PPUNTARAM & (1 << ((tmp & 0xF00) >> 10))) {
 			vnapage[((tmp & 0xF00) >> 10)][tmp & 0x3FF] = V;
+			FCEUPPU_MarkNTDirty(&vnapage[((tmp & 0xF00) >> 10)][tmp & 0x3FF]);
+		}
 	}
 }
 
@@ -442,7 +442,10 @@ void FCEU_ApplyPeriodicCheats(void)
 	{
 		if(cur->status && !(cur->type))
 			if(CheatRPtrs[cur->addr>>10])
+			{
 				CheatRPtrs[cur->addr>>10][cur->addr]=cur->val;
+				if(cur->addr < 0x800) FCEU_MARK_RAM_DIRTY(cur->addr);
+			}
 		if(cur->next)
 			cur=cur->next;
 		else
@@ -880,7 +883,10 @@ int FCEU_CheatGetByte(uint32 A)
 void FCEU_CheatSetByte(uint32 A, uint8 V)
 {
    if(CheatRPtrs[A>>10])
+   {
     CheatRPtrs[A>>10][A]=V;
+    if(A < 0x800) FCEU_MARK_RAM_DIRTY(A);
+   }
    else if(A < 0x10000)
     BWrite[A](A, V);
 }
@@ -10,6 +10,9 @@
 #include <iosfwd>
 
 void FCEUD_CallHookBeforeExec(uint16 addr);
+//called after a CPU access to an address set in the X6502_SetMemHookMaps() bitmaps. pc is the address of the current instruction.
+void FCEUD_CallHookOnRead(uint16 addr, uint8 value, uint16 pc);
+void FCEUD_CallHookOnWrite(uint16 addr, uint8 value, uint16 pc);
 
 FILE* FCEUD_UTF8fopen(const char* fn, const char* mode);
 inline FILE* FCEUD_UTF8fopen(const std::string& n, const char* mode) { return FCEUD_UTF8fopen(n.c_str(), mode); }
@@ -98,6 +101,11 @@ void FCEUI_DisableSpriteLimitation(int a);
 void FCEUI_SetRenderPlanes(bool sprites, bool bg);
 void FCEUI_GetRenderPlanes(bool& sprites, bool& bg);
 
+//headless mode: emulate without producing pixels (XBuf is left stale). game-visible PPU behaviour
+//(sprite 0 hit, sprite overflow, mapper hooks) is unchanged. old PPU only; pixel-reading input devices won't work.
+void FCEUI_SetHeadless(bool on);
+bool FCEUI_GetHeadless();
+
 //name=path and file to load.  returns null if it failed
 FCEUGI* FCEUI_LoadGame(const char* name, int OverwriteVidMode, bool silent = false);
 
@@ -152,6 +160,11 @@ void FCEUI_SetUserPalette(uint8* pal, int nEntries);
 //per second.  Only sample rates of 44100, 48000, and 96000 are currently supported.
 //If "Rate" equals 0, sound is disabled.
 void FCEUI_Sound(int Rate);
+
+//silent mode: the APU keeps its timing ($4015, frame IRQ, DMC DMA/IRQ) but synthesizes no samples.
+//CPU and RAM state are identical to running with sound.
+void FCEUI_SetSoundSilent(bool on);
+bool FCEUI_GetSoundSilent();
 void FCEUI_SetSoundVolume(uint32 volume);
 void FCEUI_SetTriangleVolume(uint32 volume);
 void FCEUI_SetSquare1Volume(uint32 volume);
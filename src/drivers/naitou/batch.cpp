@@ -0,0 +1,164 @@
+#include <cstddef>
+#include <istream>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "batch.hpp"
+#include "core.hpp"
+#include "inject.hpp"
+#include "movegen.hpp"
+#include "naitou.hpp"
+#include "notation.hpp"
+#include "pool.hpp"
+#include "prelude.hpp"
+
+namespace {
+
+// 結果待ちのジョブ
+struct Pending {
+    std::size_t line; // 入力の何行目 (空行を除く)
+    Position after_human;
+};
+
+} // anonymous namespace
+
+BatchEvaluator::BatchEvaluator(Core& core, WorkerPool& pool, const CursorPlanner& planner, BatchConfig config)
+    : core_(core)
+    , pool_(pool)
+    , planner_(planner)
+    , config_(std::move(config)) {
+    if (config_.jobs_per_worker <= 0) PANIC("BatchEvaluator::BatchEvaluator(): jobs_per_worker must be positive: {}", config_.jobs_per_worker);
+    if (config_.window == 0) PANIC("BatchEvaluator::BatchEvaluator(): window must be positive");
+}
+
+std::size_t BatchEvaluator::run(const Snapshot& root, std::istream& in, std::ostream& out) {
+    core_.snapshot_load(root);
+    if (read_side(core_) != Side::HUM) PANIC("BatchEvaluator::run(): root must be HUM's turn");
+    const auto cursor = read_cursor(core_);
+    if (!cursor.is_valid()) PANIC("BatchEvaluator::run(): cursor must be on the board: ({}, {})", cursor.x(), cursor.y());
+    const auto cur = Traveller::vertex_sq(cursor);
+
+    // 人間の手を入れた後、COM の手番になり、再び人間の手番になるまで待つ
+    const std::vector<PoolWait> waits = {
+        { ADDR_SIDE, 0, true },
+        { ADDR_SIDE, 0, false },
+    };
+
+    const std::size_t max_in_flight = std::size_t(pool_.worker_count()) * config_.jobs_per_worker;
+    std::unordered_map<u64, Pending> pending;
+    std::map<std::size_t, std::string> done; // 行 -> 出力 (前の行を待っているもの)
+    std::size_t n_read = 0;
+    std::size_t n_written = 0;
+    bool eof = false;
+    std::string line;
+    Snapshot snapshot;
+    Snapshot child;
+
+    // 行を 1 つ読んでジョブを投げる。すぐ結果が決まれば done に入れる。
+    const auto submit_line = [&](const std::size_t i, const std::string_view s) {
+        const auto sp = s.rfind(' ');
+        if (sp == std::string_view::npos) {
+            done.emplace(i, "error expected \"<position> <move>\"");
+            return;
+        }
+        const auto pos = parse_position(s.substr(0, sp));
+        if (!pos) {
+            done.emplace(i, "error invalid position");
+            return;
+        }
+        if (pos->side() != Side::HUM) {
+            done.emplace(i, "error position must be HUM's turn");
+            return;
+        }
+        const auto mv = parse_move(*pos, s.substr(sp + 1));
+        if (!mv) {
+            done.emplace(i, "error invalid or illegal move");
+            return;
+        }
+        // 選択画面の入力がなければ応手まで進まず、max_reply_frames を無駄にする
+        const bool choice = has_promotion_choice(legal_moves(*pos), *mv);
+        const auto& inputs_choice = mv->promote ? config_.inputs_promote : config_.inputs_no_promote;
+        if (choice && inputs_choice.empty()) {
+            done.emplace(i, "error promotion choice inputs are not configured");
+            return;
+        }
+
+        core_.snapshot_load(root);
+        write_position(core_, *pos);
+        core_.snapshot_save(snapshot);
+
+        PoolJob job;
+        job.snapshot = &snapshot;
+        auto writes = config_.inject ? config_.inject->writes(*mv) : std::nullopt;
+        if (writes) {
+            job.writes = std::move(*writes);
+            job.inputs = { InjectLayout::confirm_input() };
+        }
+        else {
+            const auto [src, dst] = move_vertices(*mv);
+            job.inputs = planner_.plan(cur, src, dst);
+        }
+        if (choice) job.inputs.insert(job.inputs.end(), inputs_choice.begin(), inputs_choice.end());
+        job.waits = waits;
+        job.max_wait_frames = config_.max_reply_frames;
+        job.want_snapshot = true;
+
+        // ジョブはその場で符号化されるので、snapshot は使い回してよい
+        const auto id = pool_.submit(job);
+        pending.emplace(id, Pending { i, apply_move(*pos, *mv) });
+    };
+
+    const auto handle_result = [&](const PoolResult& res) {
+        const auto it = pending.find(res.id);
+        if (it == pending.end()) PANIC("BatchEvaluator::run(): unknown job id: {}", res.id);
+        const auto p = std::move(it->second);
+        pending.erase(it);
+
+        if (!res.ok) {
+            done.emplace(p.line, "error " + res.error);
+            return;
+        }
+        if (res.timed_out) {
+            done.emplace(p.line, FORMAT("timeout - {}", res.wait_frames));
+            return;
+        }
+
+        child.assign(res.snapshot.data(), res.snapshot.size());
+        core_.snapshot_load(child);
+        const auto com = find_move_to(p.after_human, read_position(core_).hash());
+        done.emplace(p.line, FORMAT("ok {} {}", com ? format_move(*com) : "-", res.wait_frames));
+    };
+
+    for (;;) {
+        while (!eof && pool_.in_flight() < max_in_flight && n_read - n_written < config_.window) {
+            if (!std::getline(in, line)) {
+                eof = true;
+                break;
+            }
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty()) continue;
+            submit_line(n_read++, line);
+        }
+
+        for (auto it = done.begin(); it != done.end() && it->first == n_written; it = done.erase(it)) {
+            out << it->second << '\n';
+            ++n_written;
+        }
+        out.flush();
+
+        if (pool_.in_flight() == 0) {
+            if (eof) break;
+            continue;
+        }
+
+        handle_result(pool_.receive());
+    }
+
+    return n_read;
+}
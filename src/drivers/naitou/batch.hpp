@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <iosfwd>
+#include <optional>
+#include <vector>
+
+#include <boost/core/noncopyable.hpp>
+
+#include "core.hpp"
+#include "inject.hpp"
+#include "naitou.hpp"
+#include "pool.hpp"
+#include "prelude.hpp"
+
+struct BatchConfig {
+    int jobs_per_worker { 4 }; // ワーカーごとに同時に投げておくジョブ数
+    std::size_t window { 1024 }; // 読んだが出力していない行数の上限 (並べ直しのバッファの大きさ)
+    u32 max_reply_frames { 60 * 60 }; // 人間の手を入れてから COM の応手を待つフレーム数の上限
+
+    // 成/不成を選べる手で、置いた後に流す入力 (ExplorerConfig と同じ)。
+    // 空なら、その選択を要する手の行は "error" にする。
+    std::vector<Buttons> inputs_promote {};
+    std::vector<Buttons> inputs_no_promote {};
+
+    // あれば、カーソル移動の入力の代わりに RAM へ書き込んで指す (ExplorerConfig と同じ)
+    std::optional<InjectLayout> inject {};
+};
+
+// 局面と人間の手の列を読み、各々について COM の応手と思考にかかったフレーム数を返す。
+//
+// 入力は 1 行に "<局面> <人間の手>" (notation.hpp の表記。局面は HUM の手番)。空行は無視する。
+// 出力は入力と同じ順に 1 行ずつ:
+//   "ok <COM の手> <フレーム数>"   COM の手が特定できなければ "-"
+//   "timeout - <フレーム数>"       max_reply_frames 以内に応手しなかった (終局など)
+//   "error <理由>"                 行が不正, 非合法手など
+// フレーム数は人間の手を入れ終えてから COM が指し終える (再び HUM の手番になる) まで。
+//
+// 各局面は root に write_position() で書き込み、WorkerPool で並列に評価する。
+// 読み込みは window 行先までしか進めないので、入力がいくら長くてもメモリは一定。
+class BatchEvaluator : private boost::noncopyable {
+private:
+    Core& core_;
+    WorkerPool& pool_;
+    const CursorPlanner& planner_;
+    BatchConfig config_;
+
+public:
+    // core は親プロセスの Core (局面の書き込みと合法手生成に使う)。pool は core から作ったもの。
+    BatchEvaluator(Core& core, WorkerPool& pool, const CursorPlanner& planner, BatchConfig config);
+
+    // root は HUM の入力待ちで、カーソルが盤上にある状態。処理した行数を返す。
+    std::size_t run(const Snapshot& root, std::istream& in, std::ostream& out);
+};
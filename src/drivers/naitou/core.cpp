@@ -1,17 +1,24 @@
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
+#include <cstring>
+#include <deque>
+#include <optional>
 #include <string>
+#include <vector>
 
 #include <boost/core/noncopyable.hpp>
 
-#include <zlib.h>
-
 #include "debug.h"
 #include "driver.h"
-#include "emufile.h"
 #include "fceu.h"
 #include "git.h"
 #include "movie.h"
+#include "ppu.h"
+#include "sound.h"
 #include "state.h"
+#include "video.h"
+#include "x6502.h"
 
 #include "core.hpp"
 #include "driver.hpp"
@@ -21,21 +28,95 @@
 // Snapshot
 //--------------------------------------------------------------------
 
+namespace {
+
+// スナップショットの内容ごとに一意な ID。実機が最後に同期したスナップショットを
+// 再ロードするときは、書き換えられた部分だけを戻せる (FCEUSS_LoadRaw() 参照)。
+u64 next_snapshot_id() {
+    static std::atomic<u64> next { 1 };
+    return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+} // anonymous namespace
+
+// 状態は raw 形式 (登録された状態領域を memcpy で並べただけのもの) で持つ。
+// 同一プロセス内 (および fork した子) でしか意味を持たない。
 class SnapshotImpl : private boost::noncopyable {
 private:
-    EMUFILE_MEMORY file_ {};
-
-    friend class Core;
+    std::vector<u8> buf_ {};
+    u64 id_ { 0 }; // 内容を変えたら振り直す
 
 public:
     SnapshotImpl() = default;
 
-    void clear() { file_.truncate(0); }
+    [[nodiscard]] std::size_t size() const { return buf_.size(); }
+    [[nodiscard]] const u8* data() const { return buf_.data(); }
+
+    void assign(const u8* data, const std::size_t size) {
+        buf_.assign(data, data + size);
+        id_ = next_snapshot_id();
+    }
+
+    // 実機の状態をこのスナップショットに退避する。
+    void save_machine() {
+        buf_.resize(FCEUSS_RawSize());
+        id_ = next_snapshot_id();
+        FCEUSS_SaveRaw(buf_.data(), id_);
+    }
+
+    // このスナップショットを実機に復元する。
+    void load_machine() const {
+        check_size("SnapshotImpl::load_machine()");
+        FCEUSS_LoadRaw(buf_.data(), id_);
+    }
+
+    // このスナップショットに delta を当てた状態を実機に復元する。
+    void load_machine_delta(const SnapshotDelta& delta) const {
+        check_size("SnapshotImpl::load_machine_delta()");
+        if (!FCEUSS_LoadRawDelta(buf_.data(), id_, delta.data(), delta.size()))
+            PANIC("SnapshotImpl::load_machine_delta(): malformed delta");
+    }
+
+    void check_size(const char* who) const {
+        if (buf_.size() != FCEUSS_RawSize())
+            PANIC("{}: size mismatch: {} (expected: {})", who, buf_.size(), FCEUSS_RawSize());
+    }
 };
 
 Snapshot::Snapshot()
     : impl_(new SnapshotImpl) {}
 
+std::size_t Snapshot::size() const {
+    return impl_->size();
+}
+
+const u8* Snapshot::data() const {
+    return impl_->data();
+}
+
+void Snapshot::assign(const u8* data, const std::size_t size) {
+    impl_->assign(data, size);
+}
+
+//--------------------------------------------------------------------
+// SnapshotDelta
+//--------------------------------------------------------------------
+
+void SnapshotDelta::encode(const Snapshot& parent, const Snapshot& child) {
+    if (parent.size() != child.size())
+        PANIC("SnapshotDelta::encode(): size mismatch: {} vs {}", parent.size(), child.size());
+
+    bytes_.resize(FCEUSS_RawDeltaBound(child.size()));
+    bytes_.resize(FCEUSS_RawDeltaEncode(parent.data(), child.data(), child.size(), bytes_.data()));
+}
+
+void SnapshotDelta::decode(const Snapshot& parent, Snapshot& child) const {
+    std::vector<u8> buf(parent.size());
+    if (!FCEUSS_RawDeltaDecode(parent.data(), data(), size(), buf.data(), buf.size()))
+        PANIC("SnapshotDelta::decode(): malformed delta");
+    child.assign(buf.data(), buf.size());
+}
+
 //--------------------------------------------------------------------
 // HookHandle
 //--------------------------------------------------------------------
@@ -47,34 +128,81 @@ HookHandle::HookHandle(int id)
 // Core
 //--------------------------------------------------------------------
 
+namespace {
+
+// エミュレータ本体は大域変数の集まりなので、Core は 1 プロセスに 1 つしか作れない
+bool core_exists = false;
+std::vector<u8> scratch {}; // 差分セーブの作業用
+
+// 音の設定を退避し、スコープを抜けるときに (例外でも) 戻す
+class SoundSettingsScope : private boost::noncopyable {
+private:
+    int rate_;
+    bool silent_;
+
+public:
+    SoundSettingsScope()
+        : rate_(FSettings.SndRate)
+        , silent_(FCEUI_GetSoundSilent()) {}
+
+    ~SoundSettingsScope() {
+        FCEUI_Sound(rate_);
+        FCEUI_SetSoundSilent(silent_);
+    }
+};
+
+} // anonymous namespace
+
 Core::Core(const std::string& path_rom) {
+    if (core_exists) PANIC("Core::Core(): only one Core may exist per process");
+
     if (!FCEUI_Initialize()) PANIC("FCEUI_Initialize() failed");
 
     if (LoadGame(path_rom.c_str(), true) == 0) PANIC("failed to load ROM");
 
+    // 音は使わない。APU のタイミング (フレーム IRQ など) は保たれる。
+    FCEUI_SetSoundSilent(true);
+
     // 入力ポート 0 のみ有効 (標準ゲームパッド)
     FCEUI_SetInput(0, SI_GAMEPAD, &gamepad_data_, 0);
     FCEUI_SetInput(1, SI_NONE, nullptr, 0);
     FCEUI_SetInputFC(SIFC_NONE, nullptr, 0);
     FCEUI_SetInputFourscore(false);
+
+    SetActiveHookTable(&hooks_);
+
+    core_exists = true;
+}
+
+Core::~Core() {
+    SetActiveHookTable(nullptr);
+    core_exists = false;
 }
 
 int Core::frame_count() const {
     return FCEUMOV_GetFrame();
 }
 
+std::array<u8, 16> Core::rom_md5() const {
+    std::array<u8, 16> md5;
+    std::copy(std::begin(GameInfo->MD5.data), std::end(GameInfo->MD5.data), md5.begin());
+    return md5;
+}
+
 void Core::run_frame() {
     run_frame(Buttons {});
 }
 
 void Core::run_frame(Buttons buttons) {
     gamepad_data_ = buttons.value();
+    FCEUI_SetHeadless(!render_);
 
     u8* xbuf;
     i32* soundbuf;
     i32 soundbuf_size;
-    // frame skip を有効にしても別に速くならないぽい
-    FCEUI_Emulate(&xbuf, &soundbuf, &soundbuf_size, 0);
+    // frame skip は FRAMESKIP 付きでビルドしないと効かない。描画の省略は headless モードで行う。
+    // skip = 2 は音の後処理 (FlushEmulateSound) を飛ばすだけ。
+    FCEUI_Emulate(&xbuf, &soundbuf, &soundbuf_size, 2);
 }
 
 void Core::run_frames(int n) {
@@ -85,34 +213,308 @@ void Core::run_frames(int n, Buttons buttons) {
     LOOP(n) { run_frame(buttons); }
 }
 
+std::optional<std::string> Core::verify_sound_silent(const Snapshot& root, const std::vector<Buttons>& inputs, const int sound_rate) {
+    if (sound_rate <= 0) PANIC("Core::verify_sound_silent(): sound_rate must be positive: {}", sound_rate);
+
+    const SoundSettingsScope sound_settings;
+
+    struct Region {
+        const char* name;
+        u16 base;
+        std::vector<u8> bytes;
+    };
+
+    // 通常モードは音の後処理 (FlushEmulateSound) まで含めて走らせる
+    const auto run = [&](const bool silent) {
+        FCEUI_Sound(sound_rate);
+        FCEUI_SetSoundSilent(silent);
+        snapshot_load(root);
+
+        for (const auto buttons : inputs) {
+            gamepad_data_ = buttons.value();
+            FCEUI_SetHeadless(!render_);
+
+            u8* xbuf;
+            i32* soundbuf;
+            i32 soundbuf_size;
+            FCEUI_Emulate(&xbuf, &soundbuf, &soundbuf_size, silent ? 2 : 0);
+        }
+
+        std::vector<Region> regions;
+
+        const u64 cycles = timestampbase + timestamp;
+        std::vector<u8> cpu = { u8(X.PC), u8(X.PC >> 8), X.A, X.X, X.Y, X.S, X.P, X.jammed };
+        for (const auto i : IRANGE(4))
+            cpu.push_back(u8(X.IRQlow >> (8 * i)));
+        for (const auto i : IRANGE(8))
+            cpu.push_back(u8(cycles >> (8 * i)));
+        regions.push_back({ "CPU", 0, std::move(cpu) });
+
+        regions.push_back({ "RAM", 0, std::vector<u8>(RAM, RAM + 0x800) });
+
+        std::vector<u8> wram(0x2000);
+        read_bytes(0x6000, wram.size(), wram.data());
+        regions.push_back({ "WRAM", 0x6000, std::move(wram) });
+
+        FCEUSND_VISIBLE apu;
+        FCEUSND_GetVisible(&apu);
+        const auto* p = reinterpret_cast<const u8*>(&apu);
+        regions.push_back({ "APU", 0, std::vector<u8>(p, p + sizeof(apu)) });
+
+        return regions;
+    };
+
+    const auto normal = run(false);
+    const auto silent = run(true);
+
+    for (const auto i : IRANGE(silent.size())) {
+        const auto& a = silent[i].bytes;
+        const auto& b = normal[i].bytes;
+        const auto it = std::mismatch(a.begin(), a.end(), b.begin()).first;
+        if (it != a.end()) return FORMAT("{} ${:04X}", silent[i].name, silent[i].base + (it - a.begin()));
+    }
+
+    return std::nullopt;
+}
+
+StopEvent Core::run_until(const StopConditions& conds, Buttons buttons) {
+    if (conds.empty()) PANIC("Core::run_until(): no stop condition");
+
+    if (conds.instructions_ == 0u) return StopEvent { StopReason::Instructions, 0 };
+
+    gamepad_data_ = buttons.value();
+    FCEUI_SetHeadless(!render_);
+
+    // 最初に成立した条件だけを記録して CPU を止める (同じ命令で他の条件が成立しても無視)
+    std::optional<StopEvent> event;
+    const auto stop = [&event](const StopReason reason, const u16 addr) {
+        if (event) return;
+        event = StopEvent { reason, addr };
+        X6502_Stop();
+    };
+
+    std::vector<int> ids_exec;
+    std::vector<int> ids_read;
+    std::vector<int> ids_write;
+
+    for (const auto pc : conds.pcs_)
+        ids_exec.push_back(hooks_.add_before_exec(pc, [&stop, pc] { stop(StopReason::Pc, pc); }));
+
+    for (const auto& [addr, pred] : conds.rams_) {
+        ids_write.push_back(hooks_.add_on_write(addr, 1, [&stop, &pred = pred](const u16 a, const u8 value, u16) {
+            if (pred(value)) stop(StopReason::Ram, a);
+        }));
+    }
+
+    if (conds.input_poll_)
+        ids_read.push_back(hooks_.add_on_read(0x4016, 2, [&stop](const u16 a, u8, u16) { stop(StopReason::InputPoll, a); }));
+
+    // フックで止まっていた命令はフックなしで実行されるので、その分を数えておく
+    u64 executed = X6502_HookDone() ? 1 : 0;
+    if (conds.instructions_) {
+        const u64 n = *conds.instructions_;
+        hooks_.set_step([&stop, &executed, n] {
+            if (executed++ == n) stop(StopReason::Instructions, 0);
+        });
+    }
+
+    if (conds.cycles_) X6502_SetStopCycle(timestampbase + timestamp + std::max<u64>(*conds.cycles_, 1));
+
+    {
+        u8* xbuf;
+        i32* soundbuf;
+        i32 soundbuf_size;
+        while (!event) {
+            // run_frame() と同じく音の後処理は飛ばす
+            FCEUI_Emulate(&xbuf, &soundbuf, &soundbuf_size, 2);
+
+            if (FCEUPPU_InFrame()) {
+                // フックによらずに止まったならサイクル数
+                if (!event) event = StopEvent { StopReason::Cycles, 0 };
+            }
+            else if (conds.frame_end_ && !event) {
+                event = StopEvent { StopReason::FrameEnd, 0 };
+            }
+        }
+    }
+
+    // 後始末 (フックは実行中でないので即座に消える)
+    X6502_SetStopCycle(0);
+    if (conds.instructions_) hooks_.set_step({});
+    for (const auto id : ids_exec)
+        hooks_.remove_before_exec(id);
+    for (const auto id : ids_read)
+        hooks_.remove_on_read(id);
+    for (const auto id : ids_write)
+        hooks_.remove_on_write(id);
+
+    return *event;
+}
+
+bool Core::in_frame() const {
+    return FCEUPPU_InFrame();
+}
+
+std::size_t Core::run_batch_impl(const Snapshot& root, const std::vector<std::vector<Buttons>>& sequences, const std::function<void(std::size_t)>& at_leaf) {
+    struct Node {
+        std::vector<std::pair<u8, u32>> children {}; // (入力, 子)。最初に現れた順
+        std::vector<std::size_t> leaves {}; // ここで終わる入力列
+    };
+
+    std::vector<Node> trie(1);
+    for (const auto i : IRANGE(sequences.size())) {
+        u32 v = 0;
+        for (const auto buttons : sequences[i]) {
+            auto& children = trie[v].children;
+            const auto it = std::find_if(children.begin(), children.end(), [&buttons](const auto& e) { return e.first == buttons.value(); });
+            if (it != children.end()) {
+                v = it->second;
+            }
+            else {
+                const u32 child = trie.size();
+                children.emplace_back(buttons.value(), child);
+                trie.emplace_back();
+                v = child;
+            }
+        }
+        trie[v].leaves.push_back(i);
+    }
+
+    root.impl_->load_machine();
+    ++state_epoch_;
+
+    // 分岐点の深さごとのチェックポイント (再帰の間、要素のアドレスが変わらないよう deque)
+    std::deque<Snapshot> checkpoints;
+    std::size_t frames = 0;
+
+    const auto dfs = [&](auto&& self, u32 v, const std::size_t depth) -> void {
+        // 分岐のない区間は再帰せずに進める
+        for (;;) {
+            for (const auto i : trie[v].leaves)
+                at_leaf(i);
+            if (trie[v].children.size() != 1) break;
+            run_frame(Buttons(trie[v].children[0].first));
+            ++frames;
+            v = trie[v].children[0].second;
+        }
+
+        const auto& children = trie[v].children;
+        if (children.empty()) return;
+
+        if (checkpoints.size() <= depth) checkpoints.emplace_back();
+        snapshot_save(checkpoints[depth]);
+        for (const auto k : IRANGE(children.size())) {
+            if (k > 0) snapshot_load(checkpoints[depth]);
+            run_frame(Buttons(children[k].first));
+            ++frames;
+            self(self, children[k].second, depth + 1);
+        }
+    };
+    dfs(dfs, 0, 0);
+
+    return frames;
+}
+
+std::vector<u8> Core::frame_buffer() const {
+    return std::vector<u8>(XBuf, XBuf + 256 * 240);
+}
+
+MemView Core::ram() const {
+    return MemView(RAM, 0x800);
+}
+
+std::optional<MemView> Core::view(u16 addr, std::size_t size) const {
+    if (addr + size > 0x10000) return std::nullopt;
+
+    const auto* p = FCEU_GetPlainMemPtr(addr, size);
+    if (!p) return std::nullopt;
+    return MemView(p, size);
+}
+
 u8 Core::read_u8(u16 addr) {
     return GetMem(addr);
 }
 
+void Core::read_bytes(u16 addr, std::size_t size, u8* buf) {
+    while (size > 0) {
+        // 2KB ページ (とアドレス空間) の境界までを 1 単位として読む
+        const std::size_t n = std::min<std::size_t>(size, 0x800 - (addr & 0x7FF));
+        if (const auto* p = FCEU_GetPlainMemPtr(addr, n)) {
+            std::memcpy(buf, p, n);
+        }
+        else {
+            for (const auto i : IRANGE(n))
+                buf[i] = GetMem(u16(addr + i));
+        }
+        addr = u16(addr + n);
+        buf += n;
+        size -= n;
+    }
+}
+
 void Core::write_u8(u16 addr, u8 value) {
     BWrite[addr](addr, value);
+    ++state_epoch_;
 }
 
-void Core::snapshot_load(Snapshot& snapshot) {
-    auto& file = snapshot.impl_->file_;
-
-    file.fseek(0, SEEK_SET);
-    if (!FCEUSS_LoadFP(&file, SSLOADPARAM_NOBACKUP))
-        PANIC("FCEUSS_LoadFP() failed");
+void Core::snapshot_load(const Snapshot& snapshot) {
+    snapshot.impl_->load_machine();
+    ++state_epoch_;
 }
 
 void Core::snapshot_save(Snapshot& snapshot) const {
-    snapshot.impl_->clear();
+    snapshot.impl_->save_machine();
+}
+
+void Core::snapshot_load_delta(const Snapshot& parent, const SnapshotDelta& delta) {
+    parent.impl_->load_machine_delta(delta);
+    ++state_epoch_;
+}
+
+void Core::snapshot_save_delta(const Snapshot& parent, SnapshotDelta& delta) const {
+    parent.impl_->check_size("Core::snapshot_save_delta()");
+
+    // 同期点は parent のまま残す (兄弟の差分ロードを速いままにするため)
+    auto& buf = scratch;
+    buf.resize(FCEUSS_RawSize());
+    FCEUSS_SaveRaw(buf.data());
 
-    auto& file = snapshot.impl_->file_;
-    if (!FCEUSS_SaveMS(&file, Z_NO_COMPRESSION))
-        PANIC("FCEUSS_SaveMS() failed");
+    delta.bytes_.resize(FCEUSS_RawDeltaBound(buf.size()));
+    delta.bytes_.resize(FCEUSS_RawDeltaEncode(parent.data(), buf.data(), buf.size(), delta.bytes_.data()));
+}
+
+HookHandle Core::hook_before_exec_impl(u16 addr, std::function<void()> f) {
+    return HookHandle(hooks_.add_before_exec(addr, std::move(f)));
 }
 
 void Core::unhook_before_exec(HookHandle handle) {
-    RemoveHookBeforeExec(handle.id_);
+    hooks_.remove_before_exec(handle.id_);
 }
 
 void Core::clear_hooks_before_exec() {
-    ClearHookBeforeExec();
+    hooks_.clear_before_exec();
+}
+
+HookHandle Core::hook_on_read_impl(u16 addr, std::size_t len, std::function<void(u16, u8, u16)> f) {
+    return HookHandle(hooks_.add_on_read(addr, len, std::move(f)));
+}
+
+HookHandle Core::hook_on_write_impl(u16 addr, std::size_t len, std::function<void(u16, u8, u16)> f) {
+    return HookHandle(hooks_.add_on_write(addr, len, std::move(f)));
+}
+
+void Core::unhook_on_read(HookHandle handle) {
+    hooks_.remove_on_read(handle.id_);
+}
+
+void Core::unhook_on_write(HookHandle handle) {
+    hooks_.remove_on_write(handle.id_);
+}
+
+void Core::clear_hooks_on_read() {
+    hooks_.clear_on_read();
+}
+
+void Core::clear_hooks_on_write() {
+    hooks_.clear_on_write();
 }
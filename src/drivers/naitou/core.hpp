@@ -1,10 +1,15 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <cstddef>
 #include <functional>
 #include <memory>
+#include <optional>
 #include <string>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 #include <boost/core/noncopyable.hpp>
 
@@ -19,6 +24,9 @@ private:
 public:
     constexpr Buttons() = default;
 
+    constexpr explicit Buttons(u8 value)
+        : value_(value) {}
+
     [[nodiscard]] constexpr u8 value() const { return value_; }
 
     [[nodiscard]] constexpr bool is_empty() const { return value_ == 0; }
@@ -117,6 +125,125 @@ private:
 
 public:
     Snapshot();
+
+    // 直列化されたバイト列。プロセス間での受け渡しなどに使う。
+    [[nodiscard]] std::size_t size() const;
+    [[nodiscard]] const u8* data() const;
+    void assign(const u8* data, std::size_t size);
+};
+
+// 親スナップショットとの差分 (親との XOR のうち、0 でない区間だけを持つ)。
+// 探索木の親子は数十バイトしか違わないので、ノードごとに Snapshot を持つより桁違いに小さい。
+// 親の内容を変えると無意味になる。
+class SnapshotDelta {
+private:
+    std::vector<u8> bytes_ {};
+
+    friend class Core;
+
+public:
+    SnapshotDelta() = default;
+
+    // child を parent との差分として符号化する。
+    void encode(const Snapshot& parent, const Snapshot& child);
+
+    // parent に差分を当てた状態を child に書き出す。
+    void decode(const Snapshot& parent, Snapshot& child) const;
+
+    [[nodiscard]] std::size_t size() const { return bytes_.size(); }
+    [[nodiscard]] const u8* data() const { return bytes_.data(); }
+    void assign(const u8* data, std::size_t size) { bytes_.assign(data, data + size); }
+};
+
+// Core::run_until() の停止理由
+enum class StopReason {
+    Pc, // 指定 PC の命令を実行する直前
+    Instructions, // 指定数の命令を実行した
+    Cycles, // 指定 CPU サイクルが経過した (命令の途中では止まらないので少し超えうる)
+    Ram, // 指定アドレスへの書き込みが述語を満たした
+    InputPoll, // 入力ポート ($4016/$4017) が読まれた
+    FrameEnd, // フレームが終わった
+};
+
+struct StopEvent {
+    StopReason reason;
+    u16 addr; // Pc: PC, Ram/InputPoll: アクセスしたアドレス, それ以外: 0
+};
+
+// Core::run_until() の停止条件。メソッドチェーンで組み合わせ、最初に成立したもので止まる。
+class StopConditions {
+private:
+    std::vector<u16> pcs_ {};
+    std::optional<u64> instructions_ {};
+    std::optional<u64> cycles_ {};
+    std::vector<std::pair<u16, std::function<bool(u8)>>> rams_ {};
+    bool input_poll_ { false };
+    bool frame_end_ { false };
+
+    friend class Core;
+
+public:
+    StopConditions& pc(u16 addr) {
+        pcs_.push_back(addr);
+        return *this;
+    }
+
+    StopConditions& instructions(u64 n) {
+        instructions_ = n;
+        return *this;
+    }
+
+    StopConditions& cycles(u64 n) {
+        cycles_ = n;
+        return *this;
+    }
+
+    // addr への書き込み直後に pred(書かれた値) を評価する (書き込み以外では評価しない)。
+    StopConditions& ram(u16 addr, std::function<bool(u8)> pred) {
+        rams_.emplace_back(addr, std::move(pred));
+        return *this;
+    }
+
+    StopConditions& input_poll() {
+        input_poll_ = true;
+        return *this;
+    }
+
+    StopConditions& frame_end() {
+        frame_end_ = true;
+        return *this;
+    }
+
+    [[nodiscard]] bool empty() const {
+        return pcs_.empty() && !instructions_ && !cycles_ && rams_.empty() && !input_poll_ && !frame_end_;
+    }
+};
+
+// 実機のメモリを直接指す読み取り専用ビュー (std::span<const u8> 相当)。
+// 中身は常に実機の現在値なので、エミュレーションを進めれば変わる。
+// PRG/WRAM を指すビューはバンク切り替えで無効になる。
+class MemView {
+private:
+    const u8* data_ { nullptr };
+    std::size_t size_ { 0 };
+
+public:
+    constexpr MemView() = default;
+
+    constexpr MemView(const u8* data, std::size_t size)
+        : data_(data)
+        , size_(size) {}
+
+    [[nodiscard]] constexpr const u8* data() const { return data_; }
+    [[nodiscard]] constexpr std::size_t size() const { return size_; }
+    [[nodiscard]] constexpr bool empty() const { return size_ == 0; }
+
+    [[nodiscard]] constexpr u8 operator[](std::size_t i) const { return data_[i]; }
+
+    [[nodiscard]] constexpr const u8* begin() const { return data_; }
+    [[nodiscard]] constexpr const u8* end() const { return data_ + size_; }
+
+    [[nodiscard]] constexpr MemView subview(std::size_t offset, std::size_t size) const { return MemView(data_ + offset, size); }
 };
 
 // フック解除用
@@ -129,15 +256,43 @@ private:
     friend class Core;
 };
 
+// エミュレータ本体は大域変数の集まりなので、Core は 1 プロセスに 1 つしか作れない。
+// 並列に動かしたければプロセスを分けること。
 class Core : private boost::noncopyable {
 private:
     u32 gamepad_data_ { 0 };
+    bool render_ { false }; // 画面を描画するか
+    u64 state_epoch_ { 0 }; // state_epoch() 参照
+
+    HookTable hooks_;
+
+    HookHandle hook_before_exec_impl(u16 addr, std::function<void()> f);
+    HookHandle hook_on_read_impl(u16 addr, std::size_t len, std::function<void(u16, u8, u16)> f);
+    HookHandle hook_on_write_impl(u16 addr, std::size_t len, std::function<void(u16, u8, u16)> f);
+
+    std::size_t run_batch_impl(const Snapshot& root, const std::vector<std::vector<Buttons>>& sequences, const std::function<void(std::size_t)>& at_leaf);
 
 public:
     explicit Core(const std::string& path_rom);
+    ~Core();
 
     [[nodiscard]] int frame_count() const;
 
+    // ロード中の ROM の MD5 (キャッシュのキーなどに使う)
+    [[nodiscard]] std::array<u8, 16> rom_md5() const;
+
+    // CPU を経由せずに状態が書き換わる (スナップショットのロード, write_u8() など) たびに増える。
+    // 書き込みフックで RAM の写しを持つ側が、読み直しの要否を判定するのに使う。
+    [[nodiscard]] u64 state_epoch() const { return state_epoch_; }
+
+    // 画面を描画するかどうか (デフォルトは描画しない)。
+    // 描画しなくてもゲームから見える挙動 (sprite 0 hit など) は変わらない。
+    void set_render(bool on) { render_ = on; }
+
+    // 最後に描画したフレーム (256x240, パレットインデックス)。
+    // 実機に 1 枚しかないので、描画して走らせた直後に取ること。
+    [[nodiscard]] std::vector<u8> frame_buffer() const;
+
     // 無入力で 1 フレーム進める。
     void run_frame();
 
@@ -150,8 +305,56 @@ public:
     // 入力 buttons で n フレーム進める。
     void run_frames(int n, Buttons buttons);
 
+    // 無音モード (FCEUI_SetSoundSilent()) でゲームから見える状態が変わらないことを確かめる。
+    // root から inputs を 1 フレームずつ、sound_rate で音を合成する通常モードと無音モードとで流し、
+    // CPU レジスタとサイクル数, RAM, $6000-$7FFF, APU のうち CPU から見える部分 ($4015, フレーム IRQ, DMC) を比べる。
+    // ノイズの LFSR など音の合成にしか使わない状態は無音モードでは進まないので比べない。
+    // 一致すれば std::nullopt、しなければ最初に食い違った場所 ("RAM $01F3" など)。
+    // 音の設定は (例外でも) 元に戻し、無音モードで流した後の状態で終わる。
+    [[nodiscard]] std::optional<std::string> verify_sound_silent(const Snapshot& root, const std::vector<Buttons>& inputs, int sound_rate = 44100);
+
+    // 停止条件のどれかが成立するまで、入力 buttons で進める。フレームの途中でも止まる。
+    // フレームの途中で止まった後は run_until() で続きから再開できる
+    // (run_frame() はそのフレームの残りを走らせる。入力が効くのは次のフレームから)。
+    // フレームの途中で取ったスナップショットは、ロードするとその位置から再開する
+    // (描画途中の画面と鳴らしかけの音は保存されない)。
+    StopEvent run_until(const StopConditions& conds, Buttons buttons = Buttons {});
+
+    // フレームの途中で止まっているか
+    [[nodiscard]] bool in_frame() const;
+
+    // root から sequences の各入力列を 1 フレームずつ流し、流し終えた状態で probe(*this) を呼ぶ。
+    // 結果は入力順に sink(i, probe の戻り値) で返す。
+    // 入力列のトライを作り、分岐点でスナップショットを取るので、共通の接頭辞は 1 度しか走らせない。
+    // probe は状態を変えてはならない (読むだけ)。戻り値は実際に走らせたフレーム数 (トライの辺の数)。
+    template <class Probe, class Sink>
+    std::size_t run_batch(const Snapshot& root, const std::vector<std::vector<Buttons>>& sequences, Probe&& probe, Sink&& sink) {
+        using R = std::decay_t<std::invoke_result_t<Probe&, Core&>>;
+
+        // 葉はトライの順に訪れるので、入力順に並べ直す
+        std::vector<std::optional<R>> ready(sequences.size());
+        std::size_t next = 0;
+        return run_batch_impl(root, sequences, [&](const std::size_t i) {
+            ready[i].emplace(probe(*this));
+            for (; next < ready.size() && ready[next]; ++next) {
+                sink(next, std::move(*ready[next]));
+                ready[next].reset();
+            }
+        });
+    }
+
+    // 内部 RAM ($0000-$07FF) 全体のビュー。
+    [[nodiscard]] MemView ram() const;
+
+    // [addr, addr+size) が副作用なしにそのまま読める普通のメモリ (内部 RAM, CartBR 経由の PRG/WRAM) なら、そのビュー。
+    // レジスタ、チート、マッパー固有の読み出しハンドラが絡む範囲や、2KB ページを跨ぐ範囲は std::nullopt。
+    [[nodiscard]] std::optional<MemView> view(u16 addr, std::size_t size) const;
+
     u8 read_u8(u16 addr);
 
+    // 普通のメモリの部分はページ単位でコピーし、それ以外は 1 バイトずつ read_u8() と同様に読む。
+    void read_bytes(u16 addr, std::size_t size, u8* buf);
+
     template <size_t N>
     void read_bytes(u16 addr, u8 (&buf)[N]) {
         read_bytes(addr, N, buf);
@@ -164,9 +367,9 @@ public:
 
     template <class OutputIt>
     void read_bytes(u16 addr, const std::size_t size, OutputIt first) {
-        LOOP(size) {
-            *first++ = read_u8(addr++);
-        }
+        std::vector<u8> buf(size);
+        read_bytes(addr, size, buf.data());
+        std::copy(buf.begin(), buf.end(), first);
     }
 
     void write_u8(u16 addr, u8 value);
@@ -177,16 +380,42 @@ public:
             write_u8(addr++, *first);
     }
 
-    void snapshot_load(Snapshot& snapshot);
+    void snapshot_load(const Snapshot& snapshot);
 
     void snapshot_save(Snapshot& snapshot) const;
 
+    // parent に delta を当てた状態を復元する。
+    // 直前に parent (またはその子) をロードしていれば、書き換えられた部分だけを戻すので速い。
+    void snapshot_load_delta(const Snapshot& parent, const SnapshotDelta& delta);
+
+    // 現在の状態を parent との差分として delta に保存する。
+    void snapshot_save_delta(const Snapshot& parent, SnapshotDelta& delta) const;
+
     template <class F>
     HookHandle hook_before_exec(u16 addr, F&& f) {
-        return HookHandle(AddHookBeforeExec(addr, std::function<void()>(std::forward<F>(f))));
+        return hook_before_exec_impl(addr, std::function<void()>(std::forward<F>(f)));
     }
 
     void unhook_before_exec(HookHandle handle);
 
     void clear_hooks_before_exec();
+
+    // [addr, addr+len) を CPU が読んだ直後に f(addr, value, pc) を呼ぶ。
+    // pc はアクセスした命令のアドレス。フックのないアドレスへのアクセスはビット 1 つの判定で済む。
+    template <class F>
+    HookHandle hook_on_read(u16 addr, std::size_t len, F&& f) {
+        return hook_on_read_impl(addr, len, std::function<void(u16, u8, u16)>(std::forward<F>(f)));
+    }
+
+    // [addr, addr+len) に CPU が書いた直後に f(addr, value, pc) を呼ぶ。
+    template <class F>
+    HookHandle hook_on_write(u16 addr, std::size_t len, F&& f) {
+        return hook_on_write_impl(addr, len, std::function<void(u16, u8, u16)>(std::forward<F>(f)));
+    }
+
+    void unhook_on_read(HookHandle handle);
+    void unhook_on_write(HookHandle handle);
+
+    void clear_hooks_on_read();
+    void clear_hooks_on_write();
 };
@@ -8,11 +8,14 @@
 #include <utility>
 #include <vector>
 
+#include <boost/core/noncopyable.hpp>
+
 #include "driver.h"
 #include "emufile.h"
 #include "file.h"
 #include "git.h"
 #include "types.h"
+#include "x6502.h"
 
 #include "driver.hpp"
 #include "prelude.hpp"
@@ -29,23 +32,33 @@ namespace {
 
 int is_loaded = 0;
 
-struct HookExec {
-    int id;
-    u16 addr;
-    std::function<void()> f;
-    HookExec(int id, u16 addr, std::function<void()> f)
-        : id(id)
-        , addr(addr)
-        , f(std::move(f)) {}
-};
-
-std::vector<HookExec> hooks_before_exec;
+HookTable* active_hook_table = nullptr;
 
-int gen_hook_id() {
-    static int id = 0;
-    return id++;
+// CPU ループの機能は必要なものだけ有効にする (デバッガや Lua は使わない)。
+// フックが 1 つもなければ命令/アクセスごとのフック判定も省ける。
+void update_cpu_features() {
+    u32 features = 0;
+    if (active_hook_table) {
+        if (!active_hook_table->empty()) features |= X6502_FEAT_DRIVER_HOOK;
+        if (!active_hook_table->empty_mem()) features |= X6502_FEAT_MEM_HOOK;
+        X6502_SetMemHookMaps(active_hook_table->read_bitmap(), active_hook_table->write_bitmap());
+    }
+    else {
+        X6502_SetMemHookMaps(nullptr, nullptr);
+    }
+    X6502_SetFeatures(features);
 }
 
+// フック呼び出し中のフラグを立て、スコープを抜けるときに (例外でも) 下ろす
+class DispatchScope : private boost::noncopyable {
+private:
+    bool& flag_;
+
+public:
+    explicit DispatchScope(bool& flag) : flag_(flag) { flag_ = true; }
+    ~DispatchScope() { flag_ = false; }
+};
+
 } // namespace anonymous
 
 //--------------------------------------------------------------------
@@ -53,32 +66,253 @@ int gen_hook_id() {
 //--------------------------------------------------------------------
 
 void FCEUD_CallHookBeforeExec(const u16 addr) {
-    for (const auto& hook : hooks_before_exec) {
-        if (hook.addr == addr)
-            hook.f();
+    if (active_hook_table && active_hook_table->is_hooked(addr)) active_hook_table->call_before_exec(addr);
+}
+
+// ビットマップの判定は CPU コア側で済んでいる
+void FCEUD_CallHookOnRead(const u16 addr, const u8 value, const u16 pc) {
+    if (active_hook_table) active_hook_table->call_on_read(addr, value, pc);
+}
+
+void FCEUD_CallHookOnWrite(const u16 addr, const u8 value, const u16 pc) {
+    if (active_hook_table) active_hook_table->call_on_write(addr, value, pc);
+}
+
+void SetActiveHookTable(HookTable* table) {
+    active_hook_table = table;
+    update_cpu_features();
+}
+
+int HookTable::add_before_exec(const u16 addr, std::function<void()> f) {
+    const int id = next_id_++;
+    exec_addrs_.emplace(id, addr);
+
+    // 呼び出し中のバケットを伸ばすと実行中の関数オブジェクトが動いてしまう
+    if (dispatching_)
+        pending_adds_.emplace_back(addr, HookExec(id, std::move(f)));
+    else
+        insert_before_exec(addr, HookExec(id, std::move(f)));
+
+    if (this == active_hook_table) update_cpu_features();
+    return id;
+}
+
+void HookTable::remove_before_exec(const int id) {
+    const auto it = exec_addrs_.find(id);
+    if (it == exec_addrs_.end()) PANIC("HookTable::remove_before_exec(): invalid id: {}", id);
+
+    const u16 addr = it->second;
+    exec_addrs_.erase(it);
+
+    if (dispatching_) {
+        const auto pred = [id](const auto& hook) { return hook.id == id; };
+
+        // まだ反映していない追加ならそれを取り消すだけ
+        const auto it_add = std::find_if(pending_adds_.begin(), pending_adds_.end(), [&pred](const auto& p) { return pred(p.second); });
+        if (it_add != pending_adds_.end()) {
+            pending_adds_.erase(it_add);
+        }
+        else {
+            auto& bucket = hooks_before_exec_.at(addr);
+            std::find_if(bucket.begin(), bucket.end(), pred)->removed = true;
+            pending_sweeps_.push_back(addr);
+        }
     }
+    else {
+        erase_before_exec(addr, id);
+    }
+
+    if (this == active_hook_table) update_cpu_features();
 }
 
-int AddHookBeforeExec(const u16 addr, std::function<void()> f) {
-    const int id = gen_hook_id();
-    hooks_before_exec.emplace_back(id, addr, f);
+void HookTable::clear_before_exec() {
+    if (dispatching_) {
+        for (auto& [addr, bucket] : hooks_before_exec_) {
+            for (auto& hook : bucket)
+                hook.removed = true;
+            pending_sweeps_.push_back(addr);
+        }
+        pending_adds_.clear();
+    }
+    else {
+        exec_bitmap_.fill(0);
+        hooks_before_exec_.clear();
+    }
+    exec_addrs_.clear();
+
+    if (this == active_hook_table) update_cpu_features();
+}
+
+void HookTable::set_step(std::function<void()> f) {
+    hook_step_ = std::move(f);
+    if (this == active_hook_table) update_cpu_features();
+}
+
+void HookTable::call_before_exec(const u16 addr) {
+    if (hook_step_) hook_step_();
+
+    const auto it = hooks_before_exec_.find(addr);
+    if (it == hooks_before_exec_.end()) return;
+
+    {
+        const DispatchScope dispatch(dispatching_);
+        for (auto& hook : it->second) {
+            if (!hook.removed) hook.f();
+        }
+    }
+
+    if (has_pending()) flush_pending();
+}
+
+int HookTable::add_on_read(const u16 addr, const std::size_t len, std::function<void(u16, u8, u16)> f) {
+    return add_mem(hooks_on_read_, addr, len, std::move(f));
+}
+
+int HookTable::add_on_write(const u16 addr, const std::size_t len, std::function<void(u16, u8, u16)> f) {
+    return add_mem(hooks_on_write_, addr, len, std::move(f));
+}
+
+void HookTable::remove_on_read(const int id) {
+    remove_mem(hooks_on_read_, id, "HookTable::remove_on_read()");
+}
+
+void HookTable::remove_on_write(const int id) {
+    remove_mem(hooks_on_write_, id, "HookTable::remove_on_write()");
+}
+
+void HookTable::clear_on_read() {
+    clear_mem(hooks_on_read_);
+}
+
+void HookTable::clear_on_write() {
+    clear_mem(hooks_on_write_);
+}
+
+int HookTable::add_mem(MemHooks& hooks, const u16 addr, const std::size_t len, std::function<void(u16, u8, u16)> f) {
+    if (len == 0 || addr + len > 0x10000) PANIC("HookTable: invalid range: addr={:#06X}, len={}", addr, len);
+
+    const int id = next_id_++;
+    HookMem hook(id, addr, u16(addr + len - 1), std::move(f));
+
+    if (dispatching_) {
+        hooks.pending_adds.push_back(std::move(hook));
+    }
+    else {
+        for (const auto a : IRANGE<u32>(hook.first, hook.last + 1))
+            hooks.bitmap[a >> 6] |= u64 { 1 } << (a & 63);
+        hooks.hooks.push_back(std::move(hook));
+    }
+
+    if (this == active_hook_table) update_cpu_features();
     return id;
 }
 
-void RemoveHookBeforeExec(const int id) {
-    using std::begin, std::end;
+void HookTable::remove_mem(MemHooks& hooks, const int id, const char* const caller) {
+    const auto pred = [id](const auto& hook) { return hook.id == id && !hook.removed; };
+
+    if (const auto it = std::find_if(hooks.pending_adds.begin(), hooks.pending_adds.end(), pred); it != hooks.pending_adds.end()) {
+        hooks.pending_adds.erase(it);
+    }
+    else {
+        const auto it_hook = std::find_if(hooks.hooks.begin(), hooks.hooks.end(), pred);
+        if (it_hook == hooks.hooks.end()) PANIC("{}: invalid id: {}", caller, id);
+
+        if (dispatching_) {
+            it_hook->removed = true;
+            hooks.pending_sweep = true;
+        }
+        else {
+            hooks.hooks.erase(it_hook);
+            rebuild_bitmap(hooks);
+        }
+    }
 
-    const auto first = begin(hooks_before_exec);
-    const auto last = end(hooks_before_exec);
+    if (this == active_hook_table) update_cpu_features();
+}
 
-    const auto it = std::find_if(first, last, [id](const auto& hook) { return hook.id == id; });
-    if (it == last) PANIC("RemoveHookBeforeExec(): invalid id: {}", id);
+void HookTable::clear_mem(MemHooks& hooks) {
+    hooks.pending_adds.clear();
+    if (dispatching_) {
+        for (auto& hook : hooks.hooks)
+            hook.removed = true;
+        hooks.pending_sweep = true;
+    }
+    else {
+        hooks.hooks.clear();
+        hooks.bitmap.fill(0);
+    }
 
-    hooks_before_exec.erase(it);
+    if (this == active_hook_table) update_cpu_features();
 }
 
-void ClearHookBeforeExec() {
-    hooks_before_exec.clear();
+void HookTable::call_mem(MemHooks& hooks, const u16 addr, const u8 value, const u16 pc) {
+    // 読み書きフックの中からのメモリアクセスは CPU を経由しないので、入れ子にはならない
+    {
+        const DispatchScope dispatch(dispatching_);
+        for (auto& hook : hooks.hooks) {
+            if (!hook.removed && hook.first <= addr && addr <= hook.last) hook.f(addr, value, pc);
+        }
+    }
+
+    if (has_pending()) flush_pending();
+}
+
+void HookTable::rebuild_bitmap(MemHooks& hooks) {
+    hooks.bitmap.fill(0);
+    for (const auto& hook : hooks.hooks) {
+        for (const auto a : IRANGE<u32>(hook.first, hook.last + 1))
+            hooks.bitmap[a >> 6] |= u64 { 1 } << (a & 63);
+    }
+}
+
+void HookTable::insert_before_exec(const u16 addr, HookExec hook) {
+    hooks_before_exec_[addr].push_back(std::move(hook));
+    exec_bitmap_[addr >> 6] |= u64 { 1 } << (addr & 63);
+}
+
+void HookTable::erase_before_exec(const u16 addr, const int id) {
+    const auto it = hooks_before_exec_.find(addr);
+    auto& bucket = it->second;
+    bucket.erase(std::find_if(bucket.begin(), bucket.end(), [id](const auto& hook) { return hook.id == id; }));
+
+    if (bucket.empty()) {
+        hooks_before_exec_.erase(it);
+        exec_bitmap_[addr >> 6] &= ~(u64 { 1 } << (addr & 63));
+    }
+}
+
+bool HookTable::has_pending() const {
+    const auto mem_pending = [](const MemHooks& hooks) { return hooks.pending_sweep || !hooks.pending_adds.empty(); };
+    return !pending_adds_.empty() || !pending_sweeps_.empty() || mem_pending(hooks_on_read_) || mem_pending(hooks_on_write_);
+}
+
+void HookTable::flush_pending() {
+    for (const auto addr : pending_sweeps_) {
+        const auto it = hooks_before_exec_.find(addr);
+        if (it == hooks_before_exec_.end()) continue; // 同じアドレスが複数回入っていることがある
+
+        auto& bucket = it->second;
+        bucket.erase(std::remove_if(bucket.begin(), bucket.end(), [](const auto& hook) { return hook.removed; }), bucket.end());
+        if (bucket.empty()) {
+            hooks_before_exec_.erase(it);
+            exec_bitmap_[addr >> 6] &= ~(u64 { 1 } << (addr & 63));
+        }
+    }
+    pending_sweeps_.clear();
+
+    for (auto& [addr, hook] : pending_adds_)
+        insert_before_exec(addr, std::move(hook));
+    pending_adds_.clear();
+
+    for (auto* hooks : { &hooks_on_read_, &hooks_on_write_ }) {
+        if (!hooks->pending_sweep && hooks->pending_adds.empty()) continue;
+
+        hooks->hooks.erase(std::remove_if(hooks->hooks.begin(), hooks->hooks.end(), [](const auto& hook) { return hook.removed; }), hooks->hooks.end());
+        std::move(hooks->pending_adds.begin(), hooks->pending_adds.end(), std::back_inserter(hooks->hooks));
+        hooks->pending_adds.clear();
+        hooks->pending_sweep = false;
+        rebuild_bitmap(*hooks);
+    }
 }
 
 //--------------------------------------------------------------------
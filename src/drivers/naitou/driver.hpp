@@ -1,13 +1,114 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
 #include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "prelude.hpp"
 
 int LoadGame(const char* path, bool silent);
 
-// Lua API の memory.registerexec() フックに相当。
-// とりあえずナイーブな実装とする。フックの数や呼び出し頻度はたかが知れているので。
-int AddHookBeforeExec(u16 addr, std::function<void()> f);
-void RemoveHookBeforeExec(int id);
-void ClearHookBeforeExec();
+// Lua API の memory.registerexec() / registerread() / registerwrite() フックに相当。
+// 命令やメモリアクセスごとに呼ばれるので、フックされたアドレスをビットマップで持ち、
+// 大半の (フックのない) 命令/アクセスはビット 1 つの判定で済ませる。
+//
+// フックの中からフックを追加/削除してもよい。その場合、変更は呼び出し中のフックが
+// 全て終わってから反映される (削除されたフックはその時点以降呼ばれない)。
+//
+// Core が 1 つ持ち、その Core が生きている間だけ有効になる。
+class HookTable {
+private:
+    struct HookExec {
+        int id;
+        std::function<void()> f;
+        bool removed { false }; // 呼び出し中に削除された
+        HookExec(int id, std::function<void()> f)
+            : id(id)
+            , f(std::move(f)) {}
+    };
+
+    // 読み書きフックは範囲で指定され、数も少ないのでアドレスごとには分けない。
+    struct HookMem {
+        int id;
+        u16 first;
+        u16 last; // 含む
+        std::function<void(u16, u8, u16)> f;
+        bool removed { false }; // 呼び出し中に削除された
+        HookMem(int id, u16 first, u16 last, std::function<void(u16, u8, u16)> f)
+            : id(id)
+            , first(first)
+            , last(last)
+            , f(std::move(f)) {}
+    };
+
+    struct MemHooks {
+        std::array<u64, 0x10000 / 64> bitmap {}; // フックされているアドレス
+        std::vector<HookMem> hooks {};
+        std::vector<HookMem> pending_adds {};
+        bool pending_sweep { false }; // 削除されたフックが残っている
+    };
+
+    std::array<u64, 0x10000 / 64> exec_bitmap_ {}; // フックされているアドレス
+    std::unordered_map<u16, std::vector<HookExec>> hooks_before_exec_ {}; // アドレスごとのフック
+    std::unordered_map<int, u16> exec_addrs_ {}; // id -> アドレス
+    MemHooks hooks_on_read_ {};
+    MemHooks hooks_on_write_ {};
+    std::function<void()> hook_step_ {}; // 全命令の実行前に呼ぶ
+    int next_id_ { 0 };
+
+    // フック呼び出し中の追加/削除は呼び出し後に反映する
+    bool dispatching_ { false };
+    std::vector<std::pair<u16, HookExec>> pending_adds_ {};
+    std::vector<u16> pending_sweeps_ {}; // 削除されたフックが残っているアドレス
+
+    void insert_before_exec(u16 addr, HookExec hook);
+    void erase_before_exec(u16 addr, int id);
+
+    int add_mem(MemHooks& hooks, u16 addr, std::size_t len, std::function<void(u16, u8, u16)> f);
+    void remove_mem(MemHooks& hooks, int id, const char* caller);
+    void clear_mem(MemHooks& hooks);
+    void call_mem(MemHooks& hooks, u16 addr, u8 value, u16 pc);
+    static void rebuild_bitmap(MemHooks& hooks);
+
+    [[nodiscard]] bool has_pending() const;
+    void flush_pending();
+
+public:
+    int add_before_exec(u16 addr, std::function<void()> f);
+    void remove_before_exec(int id);
+    void clear_before_exec();
+
+    // [addr, addr+len) への読み込み/書き込みの直後に f(addr, value, pc) を呼ぶ。
+    // pc はアクセスした命令のアドレス。命令フェッチや DMA も読み書きに含まれる。
+    int add_on_read(u16 addr, std::size_t len, std::function<void(u16, u8, u16)> f);
+    int add_on_write(u16 addr, std::size_t len, std::function<void(u16, u8, u16)> f);
+    void remove_on_read(int id);
+    void remove_on_write(int id);
+    void clear_on_read();
+    void clear_on_write();
+
+    // 全命令の実行前に f を呼ぶ (アドレスごとのフックより先)。空の関数なら解除。遅いので一時的に使うこと。
+    void set_step(std::function<void()> f);
+
+    [[nodiscard]] bool empty() const { return exec_addrs_.empty() && !hook_step_; }
+    [[nodiscard]] bool empty_mem() const {
+        return hooks_on_read_.hooks.empty() && hooks_on_read_.pending_adds.empty()
+            && hooks_on_write_.hooks.empty() && hooks_on_write_.pending_adds.empty();
+    }
+
+    [[nodiscard]] bool is_hooked(const u16 addr) const { return hook_step_ || ((exec_bitmap_[addr >> 6] >> (addr & 63)) & 1); }
+
+    // CPU コアが直接参照する
+    [[nodiscard]] const u64* read_bitmap() const { return hooks_on_read_.bitmap.data(); }
+    [[nodiscard]] const u64* write_bitmap() const { return hooks_on_write_.bitmap.data(); }
+
+    void call_before_exec(u16 addr);
+    void call_on_read(const u16 addr, const u8 value, const u16 pc) { call_mem(hooks_on_read_, addr, value, pc); }
+    void call_on_write(const u16 addr, const u8 value, const u16 pc) { call_mem(hooks_on_write_, addr, value, pc); }
+};
+
+// 有効なフックテーブルを切り替える。nullptr なら全フック無効。
+void SetActiveHookTable(HookTable* table);
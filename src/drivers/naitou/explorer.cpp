@@ -0,0 +1,188 @@
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "core.hpp"
+#include "explorer.hpp"
+#include "inject.hpp"
+#include "movegen.hpp"
+#include "naitou.hpp"
+#include "pool.hpp"
+#include "prelude.hpp"
+#include "snapstore.hpp"
+#include "ttable.hpp"
+
+namespace {
+
+// 展開待ちの局面 (人間の手番)
+struct Node {
+    SnapshotHandle snapshot;
+    u64 hash;
+    int ply;
+};
+
+// 結果待ちのジョブ
+struct Pending {
+    std::shared_ptr<const Position> pos; // 人間の手を指す前の局面 (同じ局面のジョブで共有)
+    u64 hash;
+    Move human;
+    int ply;
+};
+
+// 展開中の局面
+struct Expansion {
+    Snapshot snapshot {};
+    std::shared_ptr<const Position> pos {};
+    u64 hash { 0 };
+    int ply { 0 };
+    int cursor { 0 };
+    std::vector<Move> moves {};
+    std::size_t next { 0 };
+};
+
+} // anonymous namespace
+
+Explorer::Explorer(Core& core, WorkerPool& pool, const CursorPlanner& planner, ExplorerConfig config)
+    : core_(core)
+    , pool_(pool)
+    , planner_(planner)
+    , config_(std::move(config))
+    , store_(config_.store_budget, config_.path_spill)
+    , tt_(config_.tt_size_log2) {
+    if (config_.depth <= 0) PANIC("Explorer::Explorer(): depth must be positive: {}", config_.depth);
+    if (config_.jobs_per_worker <= 0) PANIC("Explorer::Explorer(): jobs_per_worker must be positive: {}", config_.jobs_per_worker);
+}
+
+std::size_t Explorer::run(const Snapshot& root, const std::function<void(const ExploreRecord&)>& sink) {
+    tt_.clear();
+
+    core_.snapshot_load(root);
+    const auto root_pos = read_position(core_);
+    if (root_pos.side() != Side::HUM) PANIC("Explorer::run(): root must be HUM's turn");
+
+    std::deque<Node> frontier;
+    frontier.push_back({ store_.put(root), root_pos.hash(), 0 });
+    tt_.store(frontier.back().hash, { frontier.back().snapshot, 0 });
+
+    // 人間の手を入れた後、COM の手番になり、再び人間の手番になるまで待つ
+    const std::vector<PoolWait> waits = {
+        { ADDR_SIDE, 0, true },
+        { ADDR_SIDE, 0, false },
+    };
+
+    const std::size_t max_in_flight = std::size_t(pool_.worker_count()) * config_.jobs_per_worker;
+    std::unordered_map<u64, Pending> pending;
+    Expansion cur;
+    std::size_t n_expanded = 0;
+    Snapshot child;
+
+    const auto handle_result = [&](const PoolResult& res) {
+        const auto it = pending.find(res.id);
+        if (it == pending.end()) PANIC("Explorer::run(): unknown job id: {}", res.id);
+        const auto p = std::move(it->second);
+        pending.erase(it);
+
+        if (!res.ok) PANIC("Explorer::run(): job failed: {}", res.error);
+
+        ExploreRecord rec { p.hash, p.human, std::nullopt, res.wait_frames, res.timed_out, 0, false, p.ply, false };
+        if (!res.timed_out) {
+            child.assign(res.snapshot.data(), res.snapshot.size());
+            core_.snapshot_load(child);
+            rec.hash_child = read_position(core_).hash();
+            rec.com = find_move_to(apply_move(*p.pos, p.human), rec.hash_child);
+
+            rec.duplicate = tt_.probe(rec.hash_child).has_value();
+            // 展開しない葉はストアに入れず、以後の重複判定のためだけに置換表に載せる
+            if (!rec.duplicate) {
+                if (p.ply < config_.depth) {
+                    const auto handle = store_.put(child);
+                    tt_.store(rec.hash_child, { handle, 0 });
+                    frontier.push_back({ handle, rec.hash_child, p.ply });
+                }
+                else {
+                    tt_.store(rec.hash_child, {});
+                }
+            }
+        }
+
+        if (db_ && db_->writable()) db_->append(rec.hash, rec.human, { rec.com, rec.frames, rec.timed_out, rec.hash_child, std::nullopt });
+
+        sink(rec);
+    };
+
+    for (;;) {
+        while (pool_.in_flight() < max_in_flight) {
+            if (cur.next == cur.moves.size()) {
+                if (frontier.empty()) break;
+                const auto node = frontier.front();
+                frontier.pop_front();
+
+                // 展開中の状態は cur.snapshot にあるので、ストアからは捨てる
+                store_.get(node.snapshot, cur.snapshot);
+                store_.release(node.snapshot);
+                tt_.store(node.hash, {});
+                core_.snapshot_load(cur.snapshot);
+                const auto pos = read_position(core_);
+                const auto cursor = read_cursor(core_);
+                if (!cursor.is_valid()) PANIC("Explorer::run(): cursor must be on the board: ({}, {})", cursor.x(), cursor.y());
+
+                cur.pos = std::make_shared<const Position>(pos);
+                cur.hash = node.hash;
+                cur.ply = node.ply;
+                cur.cursor = Traveller::vertex_sq(cursor);
+                cur.moves = legal_moves(pos);
+                cur.next = 0;
+                ++n_expanded;
+                continue;
+            }
+
+            const auto mv = cur.moves[cur.next++];
+
+            // 応手後の局面を展開しないなら、既知の結果で済ませる
+            if (db_) {
+                if (const auto entry = db_->find(cur.hash, mv)) {
+                    const bool duplicate = !entry->timed_out && tt_.probe(entry->hash_child).has_value();
+                    if (entry->timed_out || duplicate || cur.ply + 1 >= config_.depth) {
+                        // 展開はしないが、以後の重複判定には含める
+                        if (!entry->timed_out && !duplicate) tt_.store(entry->hash_child, {});
+                        sink({ cur.hash, mv, entry->com, entry->frames, entry->timed_out, entry->hash_child, duplicate, cur.ply + 1, true });
+                        continue;
+                    }
+                }
+            }
+
+            const auto [src, dst] = move_vertices(mv);
+
+            PoolJob job;
+            job.snapshot = &cur.snapshot;
+            auto writes = config_.inject ? config_.inject->writes(mv) : std::nullopt;
+            if (writes) {
+                job.writes = std::move(*writes);
+                job.inputs = { InjectLayout::confirm_input() };
+            }
+            else {
+                job.inputs = planner_.plan(cur.cursor, src, dst);
+            }
+            if (has_promotion_choice(cur.moves, mv)) {
+                const auto& extra = mv.promote ? config_.inputs_promote : config_.inputs_no_promote;
+                job.inputs.insert(job.inputs.end(), extra.begin(), extra.end());
+            }
+            job.waits = waits;
+            job.max_wait_frames = config_.max_reply_frames;
+            job.want_snapshot = true;
+
+            const auto id = pool_.submit(job);
+            pending.emplace(id, Pending { cur.pos, cur.hash, mv, cur.ply + 1 });
+        }
+
+        if (pool_.in_flight() == 0) break;
+
+        handle_result(pool_.receive());
+    }
+
+    return n_expanded;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <boost/core/noncopyable.hpp>
+
+#include "core.hpp"
+#include "inject.hpp"
+#include "movegen.hpp"
+#include "naitou.hpp"
+#include "pool.hpp"
+#include "prelude.hpp"
+#include "replydb.hpp"
+#include "snapstore.hpp"
+#include "ttable.hpp"
+
+struct ExplorerConfig {
+    int depth { 1 }; // 展開する人間の手数
+    int jobs_per_worker { 4 }; // ワーカーごとに同時に投げておくジョブ数
+    u32 max_reply_frames { 60 * 60 }; // 人間の手を入れてから COM の応手を待つフレーム数の上限
+
+    // 成/不成を選べる手で、置いた後に流す入力 (ゲームの選択画面に合わせること)
+    std::vector<Buttons> inputs_promote {};
+    std::vector<Buttons> inputs_no_promote {};
+
+    // あれば、カーソル移動の入力の代わりに RAM へ書き込んで指す (verify_inject() で確かめたものを使うこと)。
+    // 書き込めない手はカーソル移動で入力する。
+    std::optional<InjectLayout> inject {};
+
+    std::size_t store_budget { std::size_t(1) << 30 }; // 展開待ちスナップショットのメモリ上限
+    std::string path_spill { "explorer.spill" };
+    int tt_size_log2 { 22 };
+};
+
+// (局面, 人間の手) -> (COM の応手, 要したフレーム数) の 1 件
+struct ExploreRecord {
+    u64 hash; // 人間の手番の局面
+    Move human;
+    std::optional<Move> com; // 応手が特定できなければ std::nullopt (timed_out を含む)
+    u32 frames; // 人間の手の入力を終えてから COM が指し終えるまで (入力の仕方によらない思考時間)
+    bool timed_out; // COM の応手を待ちきれなかった (終局や入力の失敗)
+    u64 hash_child; // COM の応手後の局面 (timed_out なら無意味)
+    bool duplicate; // hash_child は既に別の手順で現れていた (展開しない)
+    int ply; // 根からの人間の手数 (1 始まり)
+    bool cached; // エミュレートせず ReplyDb から取った
+};
+
+// 根から人間の全合法手を CursorPlanner の入力で指し、COM の応手を待って記録する、を depth 手まで繰り返す。
+//
+// 展開は親プロセスで行い、各手の実行 (入力と応手待ち) を WorkerPool に投げる。ジョブは最も暇なワーカーへ
+// 割り当て、常に jobs_per_worker 個ずつ積んでおくので、重い手 (COM の思考が長い) があっても他のワーカーは遊ばない。
+// 応手後の局面は Zobrist ハッシュで重複を除き、初出のものだけを展開する (異なる手順の合流は DAG になる)。
+// 重複判定は局面 (盤面, 持駒, 手番) のみによる。乱数などの内部状態の違いは区別しない。
+class Explorer : private boost::noncopyable {
+private:
+    Core& core_;
+    WorkerPool& pool_;
+    const CursorPlanner& planner_;
+    ExplorerConfig config_;
+
+    SnapshotStore store_;
+    TranspositionTable tt_;
+
+    ReplyDb* db_ { nullptr };
+
+public:
+    // core は親プロセスの Core (局面の読み取りと合法手生成に使う)。pool は core から作ったもの。
+    Explorer(Core& core, WorkerPool& pool, const CursorPlanner& planner, ExplorerConfig config);
+
+    // 手を指す前に db を引き、応手が分かっていて応手後の局面を展開する必要がなければエミュレートしない。
+    // db が書き込み可能なら、エミュレートした結果を追記する。nullptr なら使わない。
+    void set_reply_db(ReplyDb* db) { db_ = db; }
+
+    // root (人間の入力待ち) から探索し、結果を完了順に sink へ渡す。展開した局面数を返す。
+    std::size_t run(const Snapshot& root, const std::function<void(const ExploreRecord&)>& sink);
+};
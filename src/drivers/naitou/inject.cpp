@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <array>
+#include <map>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "core.hpp"
+#include "inject.hpp"
+#include "movegen.hpp"
+#include "naitou.hpp"
+#include "prelude.hpp"
+
+namespace {
+
+using Feature = InjectLayout::Feature;
+using Rule = InjectLayout::Rule;
+using Ram = std::array<u8, 0x800>;
+
+constexpr std::array<Feature, 9> FEATURES = {
+    Feature::Const,
+    Feature::SrcX,
+    Feature::SrcY,
+    Feature::DstX,
+    Feature::DstY,
+    Feature::SrcVertex,
+    Feature::DstVertex,
+    Feature::Pt,
+    Feature::Drop,
+};
+
+int feature_value(const Move& mv, const Feature feature) {
+    switch (feature) {
+    case Feature::Const: return 0;
+    case Feature::SrcX: return mv.src.x();
+    case Feature::SrcY: return mv.src.y();
+    case Feature::DstX: return mv.dst.x();
+    case Feature::DstY: return mv.dst.y();
+    case Feature::SrcVertex: return move_vertices(mv).first;
+    case Feature::DstVertex: return move_vertices(mv).second;
+    case Feature::Pt: return static_cast<int>(mv.pt);
+    case Feature::Drop: return mv.is_drop();
+    }
+    PANIC("feature_value(): unknown feature: {}", static_cast<int>(feature));
+}
+
+// (特徴量, 値) の観測
+using Samples = std::vector<std::pair<int, u8>>;
+
+std::optional<Rule> fit_linear(const u16 addr, const Feature feature, const Samples& samples) {
+    const auto [f0, v0] = samples.front();
+    for (const auto mul : IRANGE(256)) {
+        const u8 add = v0 - mul * f0;
+        const bool fit = std::all_of(samples.begin(), samples.end(), [&](const auto& s) { return u8(mul * s.first + add) == s.second; });
+        if (fit) return Rule { addr, feature, u8(mul), add, {} };
+    }
+    return std::nullopt;
+}
+
+std::optional<Rule> fit_table(const u16 addr, const Feature feature, const Samples& samples) {
+    std::map<int, u8> table;
+    for (const auto& [f, v] : samples) {
+        const auto [it, inserted] = table.emplace(f, v);
+        if (!inserted && it->second != v) return std::nullopt;
+    }
+    return Rule { addr, feature, 0, 0, std::move(table) };
+}
+
+// 線形な規則 (見ていない値にも使える) を優先し、なければ表
+std::optional<Rule> fit_rule(const u16 addr, const std::vector<Move>& moves, const std::vector<u8>& values) {
+    const auto samples_of = [&](const Feature feature) {
+        Samples samples;
+        for (const auto i : IRANGE(moves.size()))
+            samples.emplace_back(feature_value(moves[i], feature), values[i]);
+        return samples;
+    };
+
+    for (const auto feature : FEATURES) {
+        if (auto rule = fit_linear(addr, feature, samples_of(feature))) return rule;
+    }
+    for (const auto feature : FEATURES) {
+        if (feature == Feature::Const) continue;
+        if (auto rule = fit_table(addr, feature, samples_of(feature))) return rule;
+    }
+    return std::nullopt;
+}
+
+Ram read_ram(Core& core) {
+    Ram ram;
+    core.read_bytes(0, ram);
+    return ram;
+}
+
+// 置く A を押したフレームから COM の応手まで
+struct Reply {
+    u64 hash_child { 0 };
+    u32 frames { 0 };
+    bool timed_out { false };
+    u32 pc_hits { 0 };
+
+    friend bool operator==(const Reply& lhs, const Reply& rhs) {
+        return lhs.hash_child == rhs.hash_child && lhs.frames == rhs.frames && lhs.timed_out == rhs.timed_out && lhs.pc_hits == rhs.pc_hits;
+    }
+};
+
+// 置く直前の状態から、A を押して COM が指し終える (再び HUM の手番になる) まで進める
+Reply confirm_and_wait(Core& core, const u32 max_reply_frames, const std::optional<u16> pc_commit) {
+    Reply reply;
+
+    std::optional<HookHandle> hook;
+    if (pc_commit) hook = core.hook_before_exec(*pc_commit, [&reply]() { ++reply.pc_hits; });
+
+    core.run_frame(InjectLayout::confirm_input());
+    for (const bool com : { true, false }) {
+        while (!reply.timed_out && (read_side(core) == Side::COM) != com) {
+            if (reply.frames == max_reply_frames) {
+                reply.timed_out = true;
+                break;
+            }
+            core.run_frame();
+            ++reply.frames;
+        }
+    }
+
+    if (hook) core.unhook_before_exec(*hook);
+
+    if (!reply.timed_out) reply.hash_child = read_position(core).hash();
+    return reply;
+}
+
+} // anonymous namespace
+
+InjectLayout InjectLayout::learn(Core& core, const Snapshot& root, const CursorPlanner& planner, const std::vector<Move>& corpus) {
+    core.snapshot_load(root);
+    const auto pos = read_position(core);
+    if (pos.side() != Side::HUM) PANIC("InjectLayout::learn(): root must be HUM's turn");
+    const auto cursor = read_cursor(core);
+    if (!cursor.is_valid()) PANIC("InjectLayout::learn(): cursor must be on the board: ({}, {})", cursor.x(), cursor.y());
+    const auto legal = legal_moves(pos);
+
+    std::vector<Move> moves;
+    std::vector<Ram> rams;
+    std::map<std::size_t, Ram> rams_idle; // フレーム数 -> 無入力で進めた RAM
+    std::array<bool, 0x800> touched {};
+
+    for (const auto& mv : corpus) {
+        if (std::find(legal.begin(), legal.end(), mv) == legal.end()) PANIC("InjectLayout::learn(): illegal move in corpus");
+        if (has_promotion_choice(legal, mv)) continue;
+
+        const auto [src, dst] = move_vertices(mv);
+        const auto inputs = planner.plan_hold(Traveller::vertex_sq(cursor), src, dst);
+
+        core.snapshot_load(root);
+        for (const auto buttons : inputs)
+            core.run_frame(buttons);
+        const auto ram = read_ram(core);
+
+        // 入力がなくても変わるバイト (フレームカウンタ, 乱数など) は比べない
+        auto it = rams_idle.find(inputs.size());
+        if (it == rams_idle.end()) {
+            core.snapshot_load(root);
+            core.run_frames(static_cast<int>(inputs.size()));
+            it = rams_idle.emplace(inputs.size(), read_ram(core)).first;
+        }
+        for (const auto i : IRANGE(0x800))
+            touched[i] = touched[i] || ram[i] != it->second[i];
+
+        moves.push_back(mv);
+        rams.push_back(ram);
+    }
+    if (moves.size() < 2) PANIC("InjectLayout::learn(): corpus needs at least 2 moves without promotion choice");
+
+    InjectLayout layout;
+    for (const auto i : IRANGE(0x800)) {
+        if (!touched[i]) continue;
+
+        std::vector<u8> values;
+        for (const auto& ram : rams)
+            values.push_back(ram[i]);
+
+        if (auto rule = fit_rule(u16(i), moves, values))
+            layout.rules_.push_back(std::move(*rule));
+        else
+            layout.unexplained_.push_back(u16(i));
+    }
+
+    return layout;
+}
+
+std::optional<std::vector<std::pair<u16, u8>>> InjectLayout::writes(const Move& mv) const {
+    std::vector<std::pair<u16, u8>> res;
+    res.reserve(rules_.size());
+
+    for (const auto& rule : rules_) {
+        const auto f = feature_value(mv, rule.feature);
+        if (rule.table.empty()) {
+            res.emplace_back(rule.addr, u8(rule.mul * f + rule.add));
+            continue;
+        }
+        const auto it = rule.table.find(f);
+        if (it == rule.table.end()) return std::nullopt;
+        res.emplace_back(rule.addr, it->second);
+    }
+
+    return res;
+}
+
+bool inject_human_move(Core& core, const InjectLayout& layout, const Move& mv) {
+    const auto writes = layout.writes(mv);
+    if (!writes) return false;
+
+    for (const auto& [addr, value] : *writes)
+        core.write_u8(addr, value);
+    core.run_frame(InjectLayout::confirm_input());
+
+    return true;
+}
+
+InjectVerifyReport verify_inject(Core& core, const Snapshot& root, const CursorPlanner& planner, const InjectLayout& layout, const std::vector<Move>& corpus, const u32 max_reply_frames, const std::optional<u16> pc_commit) {
+    core.snapshot_load(root);
+    const auto pos = read_position(core);
+    if (pos.side() != Side::HUM) PANIC("verify_inject(): root must be HUM's turn");
+    const auto cursor = read_cursor(core);
+    if (!cursor.is_valid()) PANIC("verify_inject(): cursor must be on the board: ({}, {})", cursor.x(), cursor.y());
+    const auto legal = legal_moves(pos);
+
+    InjectVerifyReport report;
+    for (const auto& mv : corpus) {
+        if (std::find(legal.begin(), legal.end(), mv) == legal.end()) PANIC("verify_inject(): illegal move in corpus");
+        if (has_promotion_choice(legal, mv)) {
+            ++report.n_skipped;
+            continue;
+        }
+
+        const auto writes = layout.writes(mv);
+        if (!writes) {
+            report.unsupported.push_back(mv);
+            continue;
+        }
+
+        // カーソルを動かして入力
+        const auto [src, dst] = move_vertices(mv);
+        core.snapshot_load(root);
+        for (const auto buttons : planner.plan_hold(Traveller::vertex_sq(cursor), src, dst))
+            core.run_frame(buttons);
+        const auto typed = confirm_and_wait(core, max_reply_frames, pc_commit);
+
+        // 書き込んで入力
+        core.snapshot_load(root);
+        for (const auto& [addr, value] : *writes)
+            core.write_u8(addr, value);
+        const auto injected = confirm_and_wait(core, max_reply_frames, pc_commit);
+
+        if (typed == injected)
+            ++report.n_match;
+        else
+            report.mismatches.push_back(mv);
+    }
+
+    return report;
+}
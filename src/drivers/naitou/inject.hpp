@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "core.hpp"
+#include "movegen.hpp"
+#include "naitou.hpp"
+#include "prelude.hpp"
+
+// カーソル移動の入力を流す代わりに、指し手を置く直前の入力処理の状態を RAM に直接書き込むための規則。
+//
+// 入力処理の状態 (掴んでいる駒, カーソル位置など) は RAM にあるので、入力待ちの状態にそれを書き込めば、
+// 置く A を 1 フレーム押すだけで指し手が確定する。どのバイトに何を書くかは learn() で実際に入力して調べる:
+// 置く直前の RAM を、同じフレーム数だけ無入力で進めた RAM と比べ、違うバイトごとに、
+// 指し手の特徴量 (src, dst の座標, 駒種など) からその値を求める規則を探す。
+//
+// 規則は学んだ局面での観測に基づく推測なので、使う前に verify_inject() で確かめること。
+class InjectLayout {
+public:
+    // 規則の入力とする指し手の特徴量
+    enum class Feature : u8 {
+        Const,
+        SrcX, // 駒打ちなら 0
+        SrcY, // 駒打ちなら 0
+        DstX,
+        DstY,
+        SrcVertex, // Traveller の頂点番号 (駒打ちなら持駒の頂点)
+        DstVertex,
+        Pt,
+        Drop,
+    };
+
+    // RAM[addr] の値の求め方。table が空なら (mul * f + add) mod 256、そうでなければ表引き。
+    struct Rule {
+        u16 addr;
+        Feature feature;
+        u8 mul;
+        u8 add;
+        std::map<int, u8> table; // 表にない f では書き込めない
+    };
+
+private:
+    std::vector<Rule> rules_ {};
+    std::vector<u16> unexplained_ {}; // どの規則にも合わなかったバイト (書き込まない)
+
+public:
+    // root は HUM の入力待ちで、カーソルを自由に動かせる状態。corpus は root での合法手で、2 手以上必要
+    // (成/不成を選べる手は使わない)。各手を planner の入力で置く直前まで入力して学ぶ。core の状態は壊れる。
+    [[nodiscard]] static InjectLayout learn(Core& core, const Snapshot& root, const CursorPlanner& planner, const std::vector<Move>& corpus);
+
+    // 書き込みの後に押す、置く A の入力
+    [[nodiscard]] static constexpr Buttons confirm_input() { return Buttons {}.A(true); }
+
+    // 入力待ちの状態を、mv を置く直前の状態にするための書き込み (アドレス, 値)。
+    // 表にない特徴量の値があれば std::nullopt。
+    [[nodiscard]] std::optional<std::vector<std::pair<u16, u8>>> writes(const Move& mv) const;
+
+    [[nodiscard]] const std::vector<Rule>& rules() const { return rules_; }
+    [[nodiscard]] const std::vector<u16>& unexplained() const { return unexplained_; }
+
+    // 置く直前に変わる全てのバイトに規則があるか
+    [[nodiscard]] bool complete() const { return unexplained_.empty(); }
+};
+
+// core は HUM の入力待ち。layout で mv を置く直前の状態にし、置く A を 1 フレーム押す
+// (成/不成の選択は含まない)。書き込めなければ何もせず false を返す。
+bool inject_human_move(Core& core, const InjectLayout& layout, const Move& mv);
+
+struct InjectVerifyReport {
+    std::size_t n_match { 0 };
+    std::vector<Move> mismatches {};
+    std::vector<Move> unsupported {}; // InjectLayout::writes() できなかった
+    std::size_t n_skipped { 0 }; // 成/不成を選べる手
+
+    [[nodiscard]] bool ok() const { return mismatches.empty(); }
+};
+
+// corpus の各手 (root での合法手) を、root から planner の入力で指した場合と inject_human_move() で
+// 指した場合とで、COM の振る舞いが同じか調べる。比べるのは、応手後の局面、置く A から応手までのフレーム数、
+// max_reply_frames 以内に応手したか、および pc_commit を与えれば、置く A から応手までにその命令を
+// 実行した回数 (入力確定ルーチンへの実行フック)。core の状態は壊れる。
+[[nodiscard]] InjectVerifyReport verify_inject(Core& core, const Snapshot& root, const CursorPlanner& planner, const InjectLayout& layout, const std::vector<Move>& corpus, u32 max_reply_frames, std::optional<u16> pc_commit = std::nullopt);
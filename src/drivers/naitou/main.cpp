@@ -1,24 +1,135 @@
+#include <array>
 #include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
 #include <tuple>
+#include <vector>
 
 #include "debug.h"
 #include "driver.h"
 
+#include "batch.hpp"
 #include "core.hpp"
 #include "driver.hpp"
+#include "movegen.hpp"
 #include "naitou.hpp"
+#include "notation.hpp"
+#include "pool.hpp"
 #include "prelude.hpp"
+#include "trace.hpp"
 
 namespace {
 
 void usage() {
-    EPRINTLN("Usage: fceux <naitou.nes>");
+    EPRINTLN("Usage: fceux <naitou.nes> [--batch <n_worker> | --check-silent <n_frame>]");
+    EPRINTLN("       fceux --decode-trace <probes.cfg> <trace.bin>");
+    EPRINTLN("       fceux --perft <position|startpos> <depth>");
+    EPRINTLN("  --batch: read \"<position> <move>\" lines from stdin, write COM replies to stdout");
+    EPRINTLN("  --check-silent: check that the silent APU mode leaves the emulation state unchanged");
+    EPRINTLN("  --decode-trace: print ComTracer records as a tab-separated table");
+    EPRINTLN("  --perft: check the move generator against the naive one and print perft counts");
     std::exit(1);
 }
 
+// 標準入力の各行を評価し、標準出力へ書く
+int run_batch(const char* path_rom, const int n_worker) {
+    Core core(path_rom);
+
+    // 対局を始め、HUM の最初の入力待ちまで進める
+    core.run_frames(20);
+    core.run_frame(Buttons {}.T(true));
+    core.run_frames(20);
+    for (int i = 0; read_side(core) != Side::HUM || !read_cursor(core).is_valid(); ++i) {
+        if (i == 60 * 60) PANIC("run_batch(): the game did not reach HUM's turn");
+        core.run_frame();
+    }
+
+    Snapshot root;
+    core.snapshot_save(root);
+
+    // ワーカーは較正済みの planner を含むプロセスイメージを引き継ぐ
+    const auto planner = CursorPlanner::load_or_calibrate(core, root, ".");
+    WorkerPool pool(core, n_worker);
+
+    // 成/不成の選択画面の入力は分かっていないので、その選択を要する手は "error" になる
+    BatchEvaluator evaluator(core, pool, planner, BatchConfig {});
+    const auto n = evaluator.run(root, std::cin, std::cout);
+    EPRINTLN("{} positions", n);
+
+    return 0;
+}
+
+// 電源投入から対局開始を経て n_frame フレーム、無音モードと通常モードの状態を比べる
+int check_silent(const char* path_rom, const int n_frame) {
+    Core core(path_rom);
+
+    Snapshot root;
+    core.snapshot_save(root);
+
+    std::vector<Buttons> inputs(20 + 1 + n_frame);
+    inputs[20].T(true);
+
+    if (const auto where = core.verify_sound_silent(root, inputs)) {
+        EPRINTLN("silent mode diverged after {} frames: {}", inputs.size(), *where);
+        return 1;
+    }
+    EPRINTLN("silent mode matches normal mode for {} frames", inputs.size());
+
+    return 0;
+}
+
+// 平手の初期局面と、その深さ 1, 2, 3 の perft の既知の値
+constexpr std::string_view POSITION_STARTPOS = "lnsgkgsnl/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL b -";
+constexpr std::array<u64, 3> PERFT_STARTPOS = { 30, 900, 25470 };
+
+// 深さ 1..depth の perft を、合法手生成を素朴な実装と突き合わせながら数える。
+// 先に平手の初期局面で既知の値と一致することを確かめる。
+int run_perft(const std::string_view s, const int depth) {
+    const auto startpos = parse_position(POSITION_STARTPOS);
+    if (!startpos) PANIC("run_perft(): cannot parse the start position");
+    for (const auto i : IRANGE(PERFT_STARTPOS.size())) {
+        const auto n = perft_selftest(*startpos, int(i) + 1);
+        if (n != PERFT_STARTPOS[i]) PANIC("run_perft(): start position perft({}) = {}, expected {}", i + 1, n, PERFT_STARTPOS[i]);
+    }
+
+    const auto pos = parse_position(s == "startpos" ? POSITION_STARTPOS : s);
+    if (!pos) {
+        EPRINTLN("invalid position: {}", s);
+        return 1;
+    }
+    for (const auto d : IRANGE(1, depth + 1))
+        PRINTLN("perft({}) = {}", d, perft_selftest(*pos, d));
+
+    return 0;
+}
+
 } // anonymous namespace
 
 int main(const int argc, const char* const* argv) {
+    if (argc == 4 && std::string(argv[1]) == "--decode-trace") {
+        const auto probes = ProbeSet::load(argv[2]);
+        std::ifstream in(argv[3], std::ios::binary);
+        if (!in) PANIC("cannot open: {}", argv[3]);
+        decode_trace(probes, in, std::cout);
+        return 0;
+    }
+    if (argc == 4 && std::string(argv[1]) == "--perft") {
+        const int depth = std::atoi(argv[3]);
+        if (depth <= 0) usage();
+        return run_perft(argv[2], depth);
+    }
+    if (argc == 4 && std::string(argv[2]) == "--batch") {
+        const int n_worker = std::atoi(argv[3]);
+        if (n_worker <= 0) usage();
+        return run_batch(argv[1], n_worker);
+    }
+    if (argc == 4 && std::string(argv[2]) == "--check-silent") {
+        const int n_frame = std::atoi(argv[3]);
+        if (n_frame <= 0) usage();
+        return check_silent(argv[1], n_frame);
+    }
     if (argc != 2) usage();
     const auto path_rom = argv[1];
 
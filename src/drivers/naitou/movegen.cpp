@@ -0,0 +1,702 @@
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "movegen.hpp"
+#include "naitou.hpp"
+#include "prelude.hpp"
+
+namespace {
+
+constexpr int N_SQ = 81;
+constexpr int N_PT = 16; // Piece の値で引く表の大きさ
+
+// HUM から見た方向 (dx, dy)。HUM の前方は y の負の向き。
+constexpr std::array<std::pair<int, int>, 8> DIRS = { {
+    { -1, -1 },
+    { 0, -1 },
+    { 1, -1 },
+    { -1, 0 },
+    { 1, 0 },
+    { -1, 1 },
+    { 0, 1 },
+    { 1, 1 },
+} };
+
+constexpr u8 D_UL = 1 << 0;
+constexpr u8 D_U = 1 << 1;
+constexpr u8 D_UR = 1 << 2;
+constexpr u8 D_L = 1 << 3;
+constexpr u8 D_R = 1 << 4;
+constexpr u8 D_DL = 1 << 5;
+constexpr u8 D_D = 1 << 6;
+constexpr u8 D_DR = 1 << 7;
+
+constexpr u8 D_ORTH = D_U | D_L | D_R | D_D;
+constexpr u8 D_DIAG = D_UL | D_UR | D_DL | D_DR;
+constexpr u8 D_GOLD = D_UL | D_U | D_UR | D_L | D_R | D_D;
+constexpr u8 D_SILVER = D_UL | D_U | D_UR | D_DL | D_DR;
+
+// 駒の利き (HUM から見た向き)
+struct Rule {
+    u8 steps; // 1 マスだけ動ける方向
+    u8 slides; // 何マスでも動ける方向
+    bool knight;
+};
+
+constexpr Rule rule(const Piece pt) {
+    switch (pt) {
+    case Piece::KING: return { D_ORTH | D_DIAG, 0, false };
+    case Piece::ROOK: return { 0, D_ORTH, false };
+    case Piece::BISHOP: return { 0, D_DIAG, false };
+    case Piece::GOLD: return { D_GOLD, 0, false };
+    case Piece::SILVER: return { D_SILVER, 0, false };
+    case Piece::KNIGHT: return { 0, 0, true };
+    case Piece::LANCE: return { 0, D_U, false };
+    case Piece::PAWN: return { D_U, 0, false };
+    case Piece::DRAGON: return { D_DIAG, D_ORTH, false };
+    case Piece::HORSE: return { D_ORTH, D_DIAG, false };
+    case Piece::PRO_SILVER:
+    case Piece::PRO_KNIGHT:
+    case Piece::PRO_LANCE:
+    case Piece::PRO_PAWN: return { D_GOLD, 0, false };
+    }
+    return { 0, 0, false };
+}
+
+constexpr std::array<Piece, 14> PTS_ALL = {
+    Piece::KING,
+    Piece::ROOK,
+    Piece::BISHOP,
+    Piece::GOLD,
+    Piece::SILVER,
+    Piece::KNIGHT,
+    Piece::LANCE,
+    Piece::PAWN,
+    Piece::DRAGON,
+    Piece::HORSE,
+    Piece::PRO_SILVER,
+    Piece::PRO_KNIGHT,
+    Piece::PRO_LANCE,
+    Piece::PRO_PAWN,
+};
+
+constexpr int pt_index(const Piece pt) {
+    return static_cast<std::underlying_type_t<Piece>>(pt);
+}
+
+constexpr bool is_promotable(const Piece pt) {
+    switch (pt) {
+    case Piece::ROOK:
+    case Piece::BISHOP:
+    case Piece::SILVER:
+    case Piece::KNIGHT:
+    case Piece::LANCE:
+    case Piece::PAWN: return true;
+    default: return false;
+    }
+}
+
+constexpr Piece promoted(const Piece pt) {
+    return static_cast<Piece>(pt_index(pt) + 7);
+}
+
+constexpr Piece unpromoted(const Piece pt) {
+    return pt_index(pt) > pt_index(Piece::PAWN) ? static_cast<Piece>(pt_index(pt) - 7) : pt;
+}
+
+constexpr Side opponent(const Side side) {
+    return side == Side::COM ? Side::HUM : Side::COM;
+}
+
+constexpr int side_index(const Side side) {
+    return static_cast<int>(side);
+}
+
+// 方向 d を side から見た向きにした (dx, dy)
+constexpr std::pair<int, int> dir_of(const Side side, const int d) {
+    const auto [dx, dy] = DIRS[d];
+    return side == Side::HUM ? std::make_pair(dx, dy) : std::make_pair(dx, -dy);
+}
+
+// 盤を上下反転したマス。COM 側の規則を HUM 用の Sq のメソッドで判定するのに使う。
+constexpr Sq relative_sq(const Side side, const Sq sq) {
+    return side == Side::HUM ? sq : Sq::from_xy(sq.x(), 10 - sq.y());
+}
+
+constexpr int vertex_of(const Sq sq) {
+    return Traveller::vertex_sq(sq);
+}
+
+constexpr Sq sq_of(const int v) {
+    return Sq::from_xy(v % 9 + 1, v / 9 + 1);
+}
+
+bool in_zone(const Side side, const Sq sq) {
+    return relative_sq(side, sq).can_promote_hum();
+}
+
+// 行き所のない駒は成らねばならない (打つときの制限と同じ)
+bool must_promote(const Side side, const Piece pt, const Sq dst) {
+    return !relative_sq(side, dst).can_put_hum(pt);
+}
+
+//--------------------------------------------------------------------
+// 利きの表
+//--------------------------------------------------------------------
+
+struct Tables {
+    // steps[side][pt][v]: 1 マスの利き (桂を含む)
+    std::array<std::array<std::array<Bitboard, N_SQ>, N_PT>, 2> steps {};
+    // rays[d][v]: v から HUM 向きの方向 d へ順に辿る頂点 (-1 で終端)
+    std::array<std::array<std::array<i8, 9>, N_SQ>, 8> rays {};
+};
+
+Tables make_tables() {
+    Tables t;
+
+    for (const auto v : IRANGE(N_SQ)) {
+        const auto sq = sq_of(v);
+
+        for (const auto side : { Side::COM, Side::HUM }) {
+            for (const auto pt : PTS_ALL) {
+                const auto r = rule(pt);
+                auto& bb = t.steps[side_index(side)][pt_index(pt)][v];
+                for (const auto d : IRANGE(8)) {
+                    if (!BIT_TEST(r.steps, d)) continue;
+                    const auto [dx, dy] = dir_of(side, d);
+                    const int x = sq.x() + dx;
+                    const int y = sq.y() + dy;
+                    if (1 <= x && x <= 9 && 1 <= y && y <= 9) bb.set(vertex_of(Sq::from_xy(x, y)));
+                }
+                if (r.knight) {
+                    const int dy = side == Side::HUM ? -2 : 2;
+                    for (const int dx : { -1, 1 }) {
+                        const int x = sq.x() + dx;
+                        const int y = sq.y() + dy;
+                        if (1 <= x && x <= 9 && 1 <= y && y <= 9) bb.set(vertex_of(Sq::from_xy(x, y)));
+                    }
+                }
+            }
+        }
+
+        for (const auto d : IRANGE(8)) {
+            const auto [dx, dy] = DIRS[d];
+            auto& ray = t.rays[d][v];
+            ray.fill(-1);
+            int n = 0;
+            for (int x = sq.x() + dx, y = sq.y() + dy; 1 <= x && x <= 9 && 1 <= y && y <= 9; x += dx, y += dy)
+                ray[n++] = i8(vertex_of(Sq::from_xy(x, y)));
+        }
+    }
+
+    return t;
+}
+
+const Tables& tables() {
+    static const Tables t = make_tables();
+    return t;
+}
+
+// 方向 d (HUM 向き) を side から見た向きに直した rays の添字
+constexpr int ray_index(const Side side, const int d) {
+    constexpr std::array<int, 8> FLIP = { 5, 6, 7, 3, 4, 0, 1, 2 };
+    return side == Side::HUM ? d : FLIP[d];
+}
+
+//--------------------------------------------------------------------
+// BitPosition
+//--------------------------------------------------------------------
+
+// 合法手生成用の局面表現
+class BitPosition {
+private:
+    static constexpr u8 CELL_EMPTY = 0;
+
+    Side side_;
+    std::array<u8, N_SQ> cells_ {}; // CELL_EMPTY または pt | (side << 4)
+    std::array<Bitboard, 2> occ_ {}; // [side]
+    std::array<std::array<Bitboard, N_PT>, 2> pieces_ {}; // [side][pt]
+    std::array<std::array<u8, N_PT>, 2> hands_ {}; // [side][pt]
+    std::array<int, 2> kings_ { -1, -1 }; // [side] 玉のない局面も扱う
+
+    [[nodiscard]] static constexpr u8 encode(const Side side, const Piece pt) {
+        return u8(pt_index(pt) | (side_index(side) << 4));
+    }
+    [[nodiscard]] static constexpr Side cell_side(const u8 cell) { return static_cast<Side>(cell >> 4); }
+    [[nodiscard]] static constexpr Piece cell_pt(const u8 cell) { return static_cast<Piece>(cell & 0xF); }
+
+    void put(int v, Side side, Piece pt);
+    void remove(int v);
+
+    // 走り駒の利き (occupancy で止まる。止めた駒のマスを含む)
+    [[nodiscard]] Bitboard slide_attacks(Side side, u8 slides, int v) const;
+
+    [[nodiscard]] Bitboard attacks_from(Side side, Piece pt, int v) const;
+
+    // side の駒が v に利いているか
+    [[nodiscard]] bool attacked(int v, Side by) const;
+
+    void generate_pseudo(std::vector<Move>& moves) const;
+
+    [[nodiscard]] bool is_pawn_drop_mate(const Move& mv) const;
+
+public:
+    explicit BitPosition(const Position& pos);
+
+    [[nodiscard]] Position to_position() const;
+
+    [[nodiscard]] bool in_check(const Side side) const {
+        return kings_[side_index(side)] >= 0 && attacked(kings_[side_index(side)], opponent(side));
+    }
+
+    void do_move(const Move& mv);
+
+    void generate_legal(std::vector<Move>& moves) const;
+
+    [[nodiscard]] bool has_legal_move() const;
+};
+
+BitPosition::BitPosition(const Position& pos)
+    : side_(pos.side()) {
+    for (const auto sq : Sq::sqs_valid()) {
+        const auto& cell = pos.board()[sq];
+        if (const auto* c = std::get_if<CellCom>(&cell))
+            put(vertex_of(sq), Side::COM, c->pt);
+        else if (const auto* c = std::get_if<CellHum>(&cell))
+            put(vertex_of(sq), Side::HUM, c->pt);
+    }
+
+    for (const auto pt : pts_hand()) {
+        hands_[side_index(Side::COM)][pt_index(pt)] = pos.hand_com()[pt];
+        hands_[side_index(Side::HUM)][pt_index(pt)] = pos.hand_hum()[pt];
+    }
+}
+
+Position BitPosition::to_position() const {
+    Board board;
+    for (const auto sq : Sq::sqs_ok())
+        board[sq] = CellWall {};
+    for (const auto v : IRANGE(N_SQ)) {
+        const auto cell = cells_[v];
+        if (cell == CELL_EMPTY)
+            board[sq_of(v)] = CellEmpty {};
+        else if (cell_side(cell) == Side::COM)
+            board[sq_of(v)] = CellCom { cell_pt(cell) };
+        else
+            board[sq_of(v)] = CellHum { cell_pt(cell) };
+    }
+
+    Hand hand_com;
+    Hand hand_hum;
+    for (const auto pt : pts_hand()) {
+        hand_com[pt] = hands_[side_index(Side::COM)][pt_index(pt)];
+        hand_hum[pt] = hands_[side_index(Side::HUM)][pt_index(pt)];
+    }
+
+    return Position(side_, board, hand_com, hand_hum);
+}
+
+void BitPosition::put(const int v, const Side side, const Piece pt) {
+    cells_[v] = encode(side, pt);
+    occ_[side_index(side)].set(v);
+    pieces_[side_index(side)][pt_index(pt)].set(v);
+    if (pt == Piece::KING) kings_[side_index(side)] = v;
+}
+
+void BitPosition::remove(const int v) {
+    const auto cell = cells_[v];
+    const auto side = cell_side(cell);
+    const auto pt = cell_pt(cell);
+    cells_[v] = CELL_EMPTY;
+    occ_[side_index(side)].reset(v);
+    pieces_[side_index(side)][pt_index(pt)].reset(v);
+    if (pt == Piece::KING) kings_[side_index(side)] = -1;
+}
+
+Bitboard BitPosition::slide_attacks(const Side side, const u8 slides, const int v) const {
+    const auto& t = tables();
+    const auto occ = occ_[0] | occ_[1];
+
+    Bitboard bb;
+    for (const auto d : IRANGE(8)) {
+        if (!BIT_TEST(slides, d)) continue;
+        for (const auto u : t.rays[ray_index(side, d)][v]) {
+            if (u < 0) break;
+            bb.set(u);
+            if (occ.test(u)) break;
+        }
+    }
+    return bb;
+}
+
+Bitboard BitPosition::attacks_from(const Side side, const Piece pt, const int v) const {
+    const auto r = rule(pt);
+    auto bb = tables().steps[side_index(side)][pt_index(pt)][v];
+    if (r.slides != 0) bb |= slide_attacks(side, r.slides, v);
+    return bb;
+}
+
+bool BitPosition::attacked(const int v, const Side by) const {
+    const auto& t = tables();
+    const auto& pcs = pieces_[side_index(by)];
+    const auto rev = opponent(by);
+
+    // 1 マスの利きは、v に相手側の同じ駒を置いたときの利きと対称
+    for (const auto pt : PTS_ALL) {
+        if (pcs[pt_index(pt)].empty()) continue;
+        if (!(t.steps[side_index(rev)][pt_index(pt)][v] & pcs[pt_index(pt)]).empty()) return true;
+    }
+
+    const auto rook = pcs[pt_index(Piece::ROOK)] | pcs[pt_index(Piece::DRAGON)];
+    const auto bishop = pcs[pt_index(Piece::BISHOP)] | pcs[pt_index(Piece::HORSE)];
+    const auto lance = pcs[pt_index(Piece::LANCE)];
+    if (!(slide_attacks(rev, D_ORTH, v) & rook).empty()) return true;
+    if (!(slide_attacks(rev, D_DIAG, v) & bishop).empty()) return true;
+    if (!(slide_attacks(rev, D_U, v) & lance).empty()) return true;
+
+    return false;
+}
+
+void BitPosition::do_move(const Move& mv) {
+    const auto dst = vertex_of(mv.dst);
+
+    if (mv.is_drop()) {
+        --hands_[side_index(side_)][pt_index(mv.pt)];
+        put(dst, side_, mv.pt);
+    }
+    else {
+        if (cells_[dst] != CELL_EMPTY) {
+            const auto captured = cell_pt(cells_[dst]);
+            remove(dst);
+            // 玉を取る手は合法手生成からは出てこないが、perft の途中の擬似合法手では起こりうる
+            if (captured != Piece::KING) ++hands_[side_index(side_)][pt_index(unpromoted(captured))];
+        }
+        remove(vertex_of(mv.src));
+        put(dst, side_, mv.promote ? promoted(mv.pt) : mv.pt);
+    }
+
+    side_ = opponent(side_);
+}
+
+void BitPosition::generate_pseudo(std::vector<Move>& moves) const {
+    const auto us = side_;
+    const auto empty = ~(occ_[0] | occ_[1]);
+
+    auto froms = occ_[side_index(us)];
+    while (!froms.empty()) {
+        const auto u = froms.pop();
+        const auto pt = cell_pt(cells_[u]);
+        const auto src = sq_of(u);
+
+        auto tos = attacks_from(us, pt, u) & ~occ_[side_index(us)];
+        while (!tos.empty()) {
+            const auto dst = sq_of(tos.pop());
+            if (is_promotable(pt) && (in_zone(us, src) || in_zone(us, dst))) {
+                moves.push_back(Move::board(pt, src, dst, true));
+                if (!must_promote(us, pt, dst)) moves.push_back(Move::board(pt, src, dst, false));
+            }
+            else {
+                moves.push_back(Move::board(pt, src, dst, false));
+            }
+        }
+    }
+
+    // 二歩になる筋
+    const auto& pawns = pieces_[side_index(us)][pt_index(Piece::PAWN)];
+    std::array<bool, 10> pawn_file {};
+    for (const auto v : IRANGE(N_SQ)) {
+        if (pawns.test(v)) pawn_file[sq_of(v).x()] = true;
+    }
+
+    for (const auto pt : pts_hand()) {
+        if (hands_[side_index(us)][pt_index(pt)] == 0) continue;
+        auto tos = empty;
+        while (!tos.empty()) {
+            const auto dst = sq_of(tos.pop());
+            if (!relative_sq(us, dst).can_put_hum(pt)) continue;
+            if (pt == Piece::PAWN && pawn_file[dst.x()]) continue;
+            moves.push_back(Move::drop(pt, dst));
+        }
+    }
+}
+
+bool BitPosition::is_pawn_drop_mate(const Move& mv) const {
+    if (!mv.is_drop() || mv.pt != Piece::PAWN) return false;
+
+    // 歩の利きに相手玉がいなければ王手ではない
+    const auto them = opponent(side_);
+    const auto king = kings_[side_index(them)];
+    if (king < 0 || !tables().steps[side_index(side_)][pt_index(Piece::PAWN)][vertex_of(mv.dst)].test(king)) return false;
+
+    auto next = *this;
+    next.do_move(mv);
+    return !next.has_legal_move();
+}
+
+void BitPosition::generate_legal(std::vector<Move>& moves) const {
+    std::vector<Move> pseudo;
+    generate_pseudo(pseudo);
+
+    for (const auto& mv : pseudo) {
+        auto next = *this;
+        next.do_move(mv);
+        if (next.in_check(side_)) continue;
+        if (is_pawn_drop_mate(mv)) continue;
+        moves.push_back(mv);
+    }
+}
+
+bool BitPosition::has_legal_move() const {
+    std::vector<Move> pseudo;
+    generate_pseudo(pseudo);
+
+    return std::any_of(pseudo.begin(), pseudo.end(), [this](const Move& mv) {
+        auto next = *this;
+        next.do_move(mv);
+        return !next.in_check(side_) && !is_pawn_drop_mate(mv);
+    });
+}
+
+u64 perft_impl(const BitPosition& pos, const int depth) {
+    if (depth == 0) return 1;
+
+    std::vector<Move> moves;
+    pos.generate_legal(moves);
+    if (depth == 1) return moves.size();
+
+    u64 n = 0;
+    for (const auto& mv : moves) {
+        auto next = pos;
+        next.do_move(mv);
+        n += perft_impl(next, depth - 1);
+    }
+    return n;
+}
+
+//--------------------------------------------------------------------
+// 素朴な実装 (perft_selftest() 用)
+//--------------------------------------------------------------------
+
+// Position の盤面をそのまま走査する。速さは考えない。
+namespace naive {
+
+    bool on_board(const int x, const int y) {
+        return 1 <= x && x <= 9 && 1 <= y && y <= 9;
+    }
+
+    // (side, pt) が盤上にあるか
+    const Piece* owned(const Cell& cell, const Side side) {
+        if (side == Side::COM) {
+            if (const auto* c = std::get_if<CellCom>(&cell)) return &c->pt;
+        }
+        else {
+            if (const auto* c = std::get_if<CellHum>(&cell)) return &c->pt;
+        }
+        return nullptr;
+    }
+
+    // src にいる side の駒 pt が動けるマス (自駒のマスを除く)
+    std::vector<Sq> destinations(const Position& pos, const Side side, const Piece pt, const Sq src) {
+        const auto r = rule(pt);
+        const auto& board = pos.board();
+
+        std::vector<Sq> dsts;
+        const auto try_add = [&](const int x, const int y) {
+            if (!on_board(x, y)) return false;
+            const auto sq = Sq::from_xy(x, y);
+            if (owned(board[sq], side)) return false;
+            dsts.push_back(sq);
+            return std::holds_alternative<CellEmpty>(board[sq]);
+        };
+
+        for (const auto d : IRANGE(8)) {
+            const auto [dx, dy] = dir_of(side, d);
+            if (BIT_TEST(r.steps, d)) try_add(src.x() + dx, src.y() + dy);
+            if (BIT_TEST(r.slides, d)) {
+                for (int x = src.x() + dx, y = src.y() + dy; try_add(x, y); x += dx, y += dy) {}
+            }
+        }
+        if (r.knight) {
+            const int dy = side == Side::HUM ? -2 : 2;
+            try_add(src.x() - 1, src.y() + dy);
+            try_add(src.x() + 1, src.y() + dy);
+        }
+
+        return dsts;
+    }
+
+    bool in_check(const Position& pos, const Side side) {
+        const auto& board = pos.board();
+        const auto them = opponent(side);
+
+        for (const auto sq : Sq::sqs_valid()) {
+            const auto* pt = owned(board[sq], them);
+            if (!pt) continue;
+            for (const auto dst : destinations(pos, them, *pt, sq)) {
+                const auto* target = owned(board[dst], side);
+                if (target && *target == Piece::KING) return true;
+            }
+        }
+        return false;
+    }
+
+    Position apply(const Position& pos, const Move& mv) {
+        const auto us = pos.side();
+        auto board = pos.board();
+        auto hand_com = pos.hand_com();
+        auto hand_hum = pos.hand_hum();
+        auto& hand = us == Side::COM ? hand_com : hand_hum;
+
+        const auto pt_new = mv.promote ? promoted(mv.pt) : mv.pt;
+        if (mv.is_drop()) {
+            --hand[mv.pt];
+        }
+        else {
+            const auto* captured = owned(board[mv.dst], opponent(us));
+            if (captured && *captured != Piece::KING) ++hand[unpromoted(*captured)];
+            board[mv.src] = CellEmpty {};
+        }
+        if (us == Side::COM)
+            board[mv.dst] = CellCom { pt_new };
+        else
+            board[mv.dst] = CellHum { pt_new };
+
+        return Position(opponent(us), board, hand_com, hand_hum);
+    }
+
+    std::vector<Move> generate_legal(const Position& pos);
+
+    bool has_legal_move(const Position& pos) {
+        return !generate_legal(pos).empty();
+    }
+
+    std::vector<Move> generate_legal(const Position& pos) {
+        const auto us = pos.side();
+        const auto& board = pos.board();
+        const auto& hand = us == Side::COM ? pos.hand_com() : pos.hand_hum();
+
+        std::vector<Move> pseudo;
+        for (const auto src : Sq::sqs_valid()) {
+            const auto* pt = owned(board[src], us);
+            if (!pt) continue;
+            for (const auto dst : destinations(pos, us, *pt, src)) {
+                const bool can = is_promotable(*pt) && (in_zone(us, src) || in_zone(us, dst));
+                const bool must = can && must_promote(us, *pt, dst);
+                if (can) pseudo.push_back(Move::board(*pt, src, dst, true));
+                if (!must) pseudo.push_back(Move::board(*pt, src, dst, false));
+            }
+        }
+        for (const auto pt : pts_hand()) {
+            if (hand[pt] == 0) continue;
+            for (const auto dst : Sq::sqs_valid()) {
+                if (!std::holds_alternative<CellEmpty>(board[dst])) continue;
+                if (!relative_sq(us, dst).can_put_hum(pt)) continue;
+                if (pt == Piece::PAWN) {
+                    bool nifu = false;
+                    for (const auto y : IRANGE(1, 10)) {
+                        const auto* p = owned(board[Sq::from_xy(dst.x(), y)], us);
+                        nifu |= p && *p == Piece::PAWN;
+                    }
+                    if (nifu) continue;
+                }
+                pseudo.push_back(Move::drop(pt, dst));
+            }
+        }
+
+        std::vector<Move> moves;
+        for (const auto& mv : pseudo) {
+            const auto next = apply(pos, mv);
+            if (in_check(next, us)) continue;
+            if (mv.is_drop() && mv.pt == Piece::PAWN && in_check(next, opponent(us)) && !has_legal_move(next)) continue;
+            moves.push_back(mv);
+        }
+        return moves;
+    }
+
+} // namespace naive
+
+std::string move_str(const Move& mv) {
+    if (mv.is_drop()) return FORMAT("drop {} -> ({}, {})", pt_index(mv.pt), mv.dst.x(), mv.dst.y());
+    return FORMAT("{} ({}, {}) -> ({}, {}){}", pt_index(mv.pt), mv.src.x(), mv.src.y(), mv.dst.x(), mv.dst.y(), mv.promote ? " +" : "");
+}
+
+u64 perft_selftest_impl(const Position& pos, const int depth) {
+    if (depth == 0) return 1;
+
+    auto moves = legal_moves(pos);
+    auto moves_naive = naive::generate_legal(pos);
+    std::sort(moves.begin(), moves.end());
+    std::sort(moves_naive.begin(), moves_naive.end());
+    if (moves != moves_naive) {
+        std::vector<std::string> extra;
+        std::vector<std::string> missing;
+        for (const auto& mv : moves) {
+            if (!std::binary_search(moves_naive.begin(), moves_naive.end(), mv)) extra.push_back(move_str(mv));
+        }
+        for (const auto& mv : moves_naive) {
+            if (!std::binary_search(moves.begin(), moves.end(), mv)) missing.push_back(move_str(mv));
+        }
+        PANIC("perft_selftest(): move mismatch: extra={}, missing={}", extra, missing);
+    }
+
+    u64 n = 0;
+    for (const auto& mv : moves) {
+        const auto next = apply_move(pos, mv);
+        const auto next_naive = naive::apply(pos, mv);
+        if (next.hash() != next_naive.hash()) PANIC("perft_selftest(): apply mismatch: {}", move_str(mv));
+        n += perft_selftest_impl(next, depth - 1);
+    }
+    return n;
+}
+
+} // anonymous namespace
+
+std::vector<Move> legal_moves(const Position& pos) {
+    std::vector<Move> moves;
+    BitPosition(pos).generate_legal(moves);
+    return moves;
+}
+
+Position apply_move(const Position& pos, const Move& mv) {
+    BitPosition bpos(pos);
+    bpos.do_move(mv);
+    return bpos.to_position();
+}
+
+std::pair<int, int> move_vertices(const Move& mv) {
+    const int src = mv.is_drop() ? Traveller::vertex_hand(mv.pt) : Traveller::vertex_sq(mv.src);
+    return { src, Traveller::vertex_sq(mv.dst) };
+}
+
+std::optional<Move> find_move_to(const Position& pos, const u64 hash_child) {
+    for (const auto& mv : legal_moves(pos)) {
+        if (apply_move(pos, mv).hash() == hash_child) return mv;
+    }
+    return std::nullopt;
+}
+
+bool has_promotion_choice(const std::vector<Move>& moves, const Move& mv) {
+    if (mv.is_drop()) return false;
+    auto other = mv;
+    other.promote = !mv.promote;
+    return std::find(moves.begin(), moves.end(), other) != moves.end();
+}
+
+u64 perft(const Position& pos, const int depth) {
+    return perft_impl(BitPosition(pos), depth);
+}
+
+u64 perft_selftest(const Position& pos, const int depth) {
+    const auto n = perft_selftest_impl(pos, depth);
+
+    const auto n_fast = perft(pos, depth);
+    if (n != n_fast) PANIC("perft_selftest(): perft mismatch: {} (naive: {})", n_fast, n);
+
+    return n;
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <optional>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <boost/operators.hpp>
+
+#include "naitou.hpp"
+#include "prelude.hpp"
+
+// 盤上 81 マスのビットボード。
+// ビット番号は Traveller の盤上の頂点番号 (9 * (y - 1) + (x - 1)) と同じ。
+class Bitboard : private boost::equality_comparable<Bitboard> {
+private:
+    u64 lo_ { 0 }; // ビット 0..63
+    u64 hi_ { 0 }; // ビット 64..80
+
+    static constexpr u64 HI_MASK = (u64(1) << 17) - 1;
+
+    constexpr Bitboard(u64 lo, u64 hi)
+        : lo_(lo)
+        , hi_(hi) {}
+
+    friend constexpr bool operator==(const Bitboard& lhs, const Bitboard& rhs) {
+        return lhs.lo_ == rhs.lo_ && lhs.hi_ == rhs.hi_;
+    }
+
+public:
+    constexpr Bitboard() = default;
+
+    [[nodiscard]] static constexpr Bitboard from_index(const int i) {
+        return i < 64 ? Bitboard(u64(1) << i, 0) : Bitboard(0, u64(1) << (i - 64));
+    }
+
+    [[nodiscard]] static constexpr Bitboard all() {
+        return Bitboard(~u64(0), HI_MASK);
+    }
+
+    [[nodiscard]] constexpr bool empty() const { return (lo_ | hi_) == 0; }
+
+    [[nodiscard]] constexpr bool test(const int i) const {
+        return i < 64 ? BIT_TEST(lo_, i) : BIT_TEST(hi_, i - 64);
+    }
+
+    [[nodiscard]] int count() const { return __builtin_popcountll(lo_) + __builtin_popcountll(hi_); }
+
+    // 最下位の立っているビットを降ろし、その番号を返す。空であってはならない。
+    int pop() {
+        if (lo_ != 0) {
+            const int i = __builtin_ctzll(lo_);
+            lo_ &= lo_ - 1;
+            return i;
+        }
+        const int i = 64 + __builtin_ctzll(hi_);
+        hi_ &= hi_ - 1;
+        return i;
+    }
+
+    constexpr Bitboard& set(const int i) { return *this |= from_index(i); }
+    constexpr Bitboard& reset(const int i) { return *this &= ~from_index(i); }
+
+    constexpr Bitboard operator~() const { return Bitboard(~lo_, ~hi_ & HI_MASK); }
+
+    constexpr Bitboard& operator&=(const Bitboard& rhs) {
+        lo_ &= rhs.lo_;
+        hi_ &= rhs.hi_;
+        return *this;
+    }
+    constexpr Bitboard& operator|=(const Bitboard& rhs) {
+        lo_ |= rhs.lo_;
+        hi_ |= rhs.hi_;
+        return *this;
+    }
+    constexpr Bitboard& operator^=(const Bitboard& rhs) {
+        lo_ ^= rhs.lo_;
+        hi_ ^= rhs.hi_;
+        return *this;
+    }
+
+    friend constexpr Bitboard operator&(Bitboard lhs, const Bitboard& rhs) { return lhs &= rhs; }
+    friend constexpr Bitboard operator|(Bitboard lhs, const Bitboard& rhs) { return lhs |= rhs; }
+    friend constexpr Bitboard operator^(Bitboard lhs, const Bitboard& rhs) { return lhs ^= rhs; }
+};
+
+// 指し手。駒打ちなら src は無効なマス (Sq(0))。
+struct Move {
+    Piece pt; // 動かす駒 (成る前) または打つ駒
+    Sq src;
+    Sq dst;
+    bool promote;
+
+    [[nodiscard]] static constexpr Move board(const Piece pt, const Sq src, const Sq dst, const bool promote) {
+        return Move { pt, src, dst, promote };
+    }
+
+    [[nodiscard]] static constexpr Move drop(const Piece pt, const Sq dst) {
+        return Move { pt, Sq(0), dst, false };
+    }
+
+    [[nodiscard]] constexpr bool is_drop() const { return !src.is_valid(); }
+
+    // 32bit に詰める (ファイルや置換表に保存する用)。0 にはならない。
+    [[nodiscard]] constexpr u32 pack() const {
+        return u32(static_cast<int>(pt)) | u32(src.get()) << 4 | u32(dst.get()) << 11 | u32(promote) << 18;
+    }
+
+    [[nodiscard]] static constexpr Move unpack(const u32 packed) {
+        return Move { static_cast<Piece>(packed & 0xF), Sq((packed >> 4) & 0x7F), Sq((packed >> 11) & 0x7F), bool((packed >> 18) & 1) };
+    }
+
+    friend bool operator==(const Move& lhs, const Move& rhs) {
+        return lhs.pt == rhs.pt && lhs.src == rhs.src && lhs.dst == rhs.dst && lhs.promote == rhs.promote;
+    }
+
+    friend bool operator!=(const Move& lhs, const Move& rhs) {
+        return !(lhs == rhs);
+    }
+
+    friend bool operator<(const Move& lhs, const Move& rhs) {
+        return std::make_tuple(lhs.src.get(), lhs.dst.get(), lhs.pt, lhs.promote) < std::make_tuple(rhs.src.get(), rhs.dst.get(), rhs.pt, rhs.promote);
+    }
+};
+
+// 手番側の合法手を全て返す。
+// 成/不成の選択、行き所のない駒の強制成り、Sq::can_put_hum() の打てる段、二歩、打ち歩詰め、自殺手を考慮する。
+// COM 側は盤を上下反転して同じ規則を当てはめる。
+[[nodiscard]] std::vector<Move> legal_moves(const Position& pos);
+
+// 指し手を適用した局面 (手番は相手に移る)。mv は合法でなければならない。
+[[nodiscard]] Position apply_move(const Position& pos, const Move& mv);
+
+// 指し手の入力でカーソルを通すべき Traveller の頂点 (掴む頂点, 置く頂点)。
+// 駒打ちなら掴む頂点は持駒の頂点。成/不成の選択はこの外で行う。
+[[nodiscard]] std::pair<int, int> move_vertices(const Move& mv);
+
+// pos から指して、局面のハッシュが hash_child になる手 (なければ std::nullopt)。
+[[nodiscard]] std::optional<Move> find_move_to(const Position& pos, u64 hash_child);
+
+// moves (legal_moves() の結果) の中で、mv が成/不成を選べる手か (入力で選択画面を通る)。
+[[nodiscard]] bool has_promotion_choice(const std::vector<Move>& moves, const Move& mv);
+
+// 深さ depth までの末端局面数。
+[[nodiscard]] u64 perft(const Position& pos, int depth);
+
+// 深さ depth までの全局面で、ビットボード版の合法手生成を素朴な実装と突き合わせる。
+// 食い違えば PANIC。戻り値は perft(pos, depth) と同じ。
+u64 perft_selftest(const Position& pos, int depth);
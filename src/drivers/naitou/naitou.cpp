@@ -1,8 +1,16 @@
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <cstdio>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <queue>
+#include <string>
 #include <tuple>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "naitou.hpp"
 #include "prelude.hpp"
@@ -21,41 +29,69 @@ Piece phum2pt(u8 phum) {
     return static_cast<Piece>(phum);
 }
 
+// 盤面の 1 マスを両配列のバイトからデコードする。両者が食い違っていれば std::nullopt
+std::optional<Cell> decode_cell(u8 bcom, u8 bhum) {
+    if (bcom == CELL_BYTE_WALL && bhum == CELL_BYTE_WALL) return CellWall {};
+    if (bcom == CELL_BYTE_EMPTY && bhum == CELL_BYTE_EMPTY) return CellEmpty {};
+    if (bcom != CELL_BYTE_WALL && bhum == CELL_BYTE_EMPTY) return CellCom { pcom2pt(bcom) };
+    if (bcom == CELL_BYTE_EMPTY && bhum != CELL_BYTE_WALL) return CellHum { phum2pt(bhum) };
+    return std::nullopt;
+}
+
+// decode_cell() の逆。(COM 用配列のバイト, HUM 用配列のバイト)
+std::pair<u8, u8> encode_cell(const Cell& cell) {
+    if (std::holds_alternative<CellWall>(cell)) return { CELL_BYTE_WALL, CELL_BYTE_WALL };
+    if (const auto* c = std::get_if<CellCom>(&cell)) return { u8(static_cast<int>(c->pt) + 15), CELL_BYTE_EMPTY };
+    if (const auto* c = std::get_if<CellHum>(&cell)) return { CELL_BYTE_EMPTY, u8(static_cast<int>(c->pt)) };
+    return { CELL_BYTE_EMPTY, CELL_BYTE_EMPTY };
+}
+
+Side decode_side(u8 b) {
+    return b == 0 ? Side::COM : Side::HUM;
+}
+
 Hand read_hand(Core& core, u16 addr) {
-    std::array<u8, 7> buf;
-    core.read_bytes(addr, buf);
+    const auto ram = core.ram();
 
     Hand hand;
     for (const auto i : IRANGE(7)) {
         const auto pt = pts_hand()[i];
-        hand[pt] = buf[i];
+        hand[pt] = ram[addr + i];
     }
 
     return hand;
 }
 
-std::array<std::array<Buttons, 88>, 88> traveller_graph() {
-    constexpr Buttons OP_UL = Buttons {}.U(true).L(true);
-    constexpr Buttons OP_U = Buttons {}.U(true);
-    constexpr Buttons OP_UR = Buttons {}.U(true).R(true);
-    constexpr Buttons OP_L = Buttons {}.L(true);
-    constexpr Buttons OP_R = Buttons {}.R(true);
-    constexpr Buttons OP_DL = Buttons {}.D(true).L(true);
-    constexpr Buttons OP_D = Buttons {}.D(true);
-    constexpr Buttons OP_DR = Buttons {}.D(true).R(true);
-
-    // (dy, dx, buttons)
-    constexpr std::array<std::tuple<int, int, Buttons>, 8> NEIGHBORS = { {
-        { -1, -1, OP_UL },
-        { -1, 0, OP_U },
-        { -1, 1, OP_UR },
-        { 0, -1, OP_L },
-        { 0, 1, OP_R },
-        { 1, -1, OP_DL },
-        { 1, 0, OP_D },
-        { 1, 1, OP_DR },
-    } };
+void write_hand(Core& core, u16 addr, const Hand& hand) {
+    std::array<u8, 7> buf;
+    for (const auto i : IRANGE(7))
+        buf[i] = hand[pts_hand()[i]];
+    core.write_bytes(addr, buf.begin(), buf.end());
+}
 
+constexpr Buttons OP_UL = Buttons {}.U(true).L(true);
+constexpr Buttons OP_U = Buttons {}.U(true);
+constexpr Buttons OP_UR = Buttons {}.U(true).R(true);
+constexpr Buttons OP_L = Buttons {}.L(true);
+constexpr Buttons OP_R = Buttons {}.R(true);
+constexpr Buttons OP_DL = Buttons {}.D(true).L(true);
+constexpr Buttons OP_D = Buttons {}.D(true);
+constexpr Buttons OP_DR = Buttons {}.D(true).R(true);
+constexpr Buttons OP_A = Buttons {}.A(true);
+
+// (dy, dx, buttons)
+constexpr std::array<std::tuple<int, int, Buttons>, 8> NEIGHBORS = { {
+    { -1, -1, OP_UL },
+    { -1, 0, OP_U },
+    { -1, 1, OP_UR },
+    { 0, -1, OP_L },
+    { 0, 1, OP_R },
+    { 1, -1, OP_DL },
+    { 1, 0, OP_D },
+    { 1, 1, OP_DR },
+} };
+
+std::array<std::array<Buttons, 88>, 88> traveller_graph() {
     std::array<std::array<Buttons, 88>, 88> graph {};
 
     // 盤上のマス間の接続
@@ -145,6 +181,122 @@ std::array<std::array<Buttons, 88>, 88> traveller_graph() {
     return graph;
 }
 
+//--------------------------------------------------------------------
+// CursorPlanner 用
+//--------------------------------------------------------------------
+
+// ボタンの種類 (CursorPlanner 参照)。方向は NEIGHBORS の添字。
+constexpr int KIND_A = 8;
+constexpr int KIND_NONE = 9; // 直前の操作なし (経路探索でのみ使う)
+
+constexpr int GAP_MAX = 7; // 較正で試す最大の間隔。基準の入力列はこの間隔で押す
+constexpr int SETTLE = 8; // 入力の後、結果を比べるまでに待つフレーム数
+constexpr int SHIFT = 4; // 入力のタイミングだけで変わるバイトを見つけるためにずらすフレーム数
+
+constexpr std::array<char, 4> PLANNER_CACHE_MAGIC = { 'N', 'C', 'P', 'L' };
+constexpr u8 PLANNER_CACHE_VERSION = 1;
+
+Buttons kind_buttons(const int kind) {
+    return kind == KIND_A ? OP_A : std::get<2>(NEIGHBORS[kind]);
+}
+
+int buttons_kind(const Buttons buttons) {
+    if (buttons.value() == OP_A.value()) return KIND_A;
+    for (const auto k : IRANGE(8)) {
+        if (std::get<2>(NEIGHBORS[k]).value() == buttons.value()) return k;
+    }
+    PANIC("buttons_kind(): unexpected buttons: {:#04X}", buttons.value());
+}
+
+std::vector<Buttons> inputs_with_gap(const Buttons prev, const int gap, const Buttons next) {
+    std::vector<Buttons> inputs;
+    inputs.push_back(prev);
+    inputs.insert(inputs.end(), gap, Buttons {});
+    inputs.push_back(next);
+    return inputs;
+}
+
+// start から inputs を流し、合計 frames フレームになるまで無入力で進めた後の RAM
+std::array<u8, 0x800> ram_after(Core& core, const Snapshot& start, const std::vector<Buttons>& inputs, const int frames) {
+    core.snapshot_load(start);
+    for (const auto buttons : inputs)
+        core.run_frame(buttons);
+    core.run_frames(frames - static_cast<int>(inputs.size()));
+
+    std::array<u8, 0x800> ram;
+    core.read_bytes(0, ram);
+    return ram;
+}
+
+// 十分な間隔で押した入力列 (基準) と比べて、候補の入力列が同じ結果になるかを判定する。
+class EffectChecker {
+private:
+    Core& core_;
+    const Snapshot& start_;
+    int frames_;
+    std::array<u8, 0x800> ram_ref_;
+    std::array<bool, 0x800> noise_ {};
+
+public:
+    EffectChecker(Core& core, const Snapshot& start, const std::vector<Buttons>& inputs_ref)
+        : core_(core)
+        , start_(start)
+        , frames_(static_cast<int>(inputs_ref.size()) + SHIFT + SETTLE) {
+        ram_ref_ = ram_after(core_, start_, inputs_ref, frames_);
+
+        // 基準を遅らせて押すと変わるバイト (無入力時間のカウンタなど) は比べない
+        std::vector<Buttons> inputs_shifted(SHIFT);
+        inputs_shifted.insert(inputs_shifted.end(), inputs_ref.begin(), inputs_ref.end());
+        const auto ram_shifted = ram_after(core_, start_, inputs_shifted, frames_);
+        for (const auto i : IRANGE(0x800))
+            noise_[i] = ram_ref_[i] != ram_shifted[i];
+    }
+
+    [[nodiscard]] bool same_effect(const std::vector<Buttons>& inputs) {
+        const auto ram = ram_after(core_, start_, inputs, frames_);
+        for (const auto i : IRANGE(0x800)) {
+            if (!noise_[i] && ram[i] != ram_ref_[i]) return false;
+        }
+        return true;
+    }
+};
+
+// start でボタン prev を押した後、next を押すまでに要る最小の無入力フレーム数
+u8 measure_gap(Core& core, const Snapshot& start, const Buttons prev, const Buttons next) {
+    EffectChecker checker(core, start, inputs_with_gap(prev, GAP_MAX, next));
+    for (const auto gap : IRANGE(GAP_MAX)) {
+        if (checker.same_effect(inputs_with_gap(prev, gap, next))) return gap;
+    }
+    return GAP_MAX;
+}
+
+// 較正用: snapshot からカーソルを dst へ (十分な間隔を空けて) 動かした状態を out に保存する
+void move_cursor_slowly(Core& core, const Snapshot& snapshot, const Traveller& tra, const Sq dst, Snapshot& out) {
+    core.snapshot_load(snapshot);
+
+    const auto cur = read_cursor(core);
+    if (!cur.is_valid()) PANIC("CursorPlanner: cursor must be on the board: ({}, {})", cur.x(), cur.y());
+
+    const auto [n, seq] = tra.query(Traveller::vertex_sq(cur), Traveller::vertex_sq(dst));
+    for (const auto i : IRANGE(n)) {
+        core.run_frame(seq[i]);
+        core.run_frames(GAP_MAX);
+    }
+    core.run_frames(SETTLE);
+
+    const auto now = read_cursor(core);
+    if (now != dst) PANIC("CursorPlanner: cursor did not reach ({}, {}): ({}, {})", dst.x(), dst.y(), now.x(), now.y());
+
+    core.snapshot_save(out);
+}
+
+std::string planner_cache_path(const std::string& dir_cache, const std::array<u8, 16>& md5) {
+    std::string hex;
+    for (const auto b : md5)
+        hex += FORMAT("{:02x}", b);
+    return FORMAT("{}/cursor_planner_{}.bin", dir_cache, hex);
+}
+
 } // anonymous namespace
 
 const Cell& Board::operator[](Sq sq) const {
@@ -169,46 +321,59 @@ Position::Position(Side side, const Board& board, const Hand& hand_com, const Ha
     , hand_com_(hand_com)
     , hand_hum_(hand_hum) {}
 
+Side Position::side() const {
+    return side_;
+}
+
+const Board& Position::board() const {
+    return board_;
+}
+
+const Hand& Position::hand_com() const {
+    return hand_com_;
+}
+
+const Hand& Position::hand_hum() const {
+    return hand_hum_;
+}
+
+u64 Position::hash() const {
+    u64 h = zobrist_side(side_);
+    for (const auto sq : Sq::sqs_ok())
+        h ^= zobrist_cell(sq, board_[sq]);
+    for (const auto pt : pts_hand())
+        h ^= zobrist_hand(Side::COM, pt, hand_com_[pt]) ^ zobrist_hand(Side::HUM, pt, hand_hum_[pt]);
+    return h;
+}
+
 Side read_side(Core& core) {
-    return core.read_u8(0x77) == 0 ? Side::COM : Side::HUM;
+    return decode_side(core.ram()[ADDR_SIDE]);
 }
 
 Board read_board(Core& core) {
-    std::array<u8, 11 * 11> buf_com;
-    std::array<u8, 11 * 11> buf_hum;
-    core.read_bytes(0x49B, buf_com);
-    core.read_bytes(0x3A9, buf_hum);
+    // 盤面は内部 RAM にあるので、コピーせずに直接読む
+    const auto ram = core.ram();
+    const auto buf_com = ram.subview(ADDR_BOARD_COM, 11 * 11);
+    const auto buf_hum = ram.subview(ADDR_BOARD_HUM, 11 * 11);
 
     Board board;
     for (const auto sq : Sq::sqs_ok()) {
         u8 bcom = buf_com[sq.get()];
         u8 bhum = buf_hum[sq.get()];
-        if (bcom == CELL_BYTE_WALL && bhum == CELL_BYTE_WALL) {
-            board[sq] = CellWall {};
-        }
-        else if (bcom == CELL_BYTE_EMPTY && bhum == CELL_BYTE_EMPTY) {
-            board[sq] = CellEmpty {};
-        }
-        else if (bcom != CELL_BYTE_WALL && bhum == CELL_BYTE_EMPTY) {
-            board[sq] = CellCom { pcom2pt(bcom) };
-        }
-        else if (bcom == CELL_BYTE_EMPTY && bhum != CELL_BYTE_WALL) {
-            board[sq] = CellHum { phum2pt(bhum) };
-        }
-        else {
-            PANIC("read_board(): unreachable (bcom={}, bhum={})", bcom, bhum);
-        }
+        const auto cell = decode_cell(bcom, bhum);
+        if (!cell) PANIC("read_board(): unreachable (bcom={}, bhum={})", bcom, bhum);
+        board[sq] = *cell;
     }
 
     return board;
 }
 
 Hand read_hand_com(Core& core) {
-    return read_hand(core, 0x594);
+    return read_hand(core, ADDR_HAND_COM);
 }
 
 Hand read_hand_hum(Core& core) {
-    return read_hand(core, 0x58D);
+    return read_hand(core, ADDR_HAND_HUM);
 }
 
 Position read_position(Core& core) {
@@ -220,9 +385,162 @@ Position read_position(Core& core) {
     return Position(side, board, hand_com, hand_hum);
 }
 
+void write_position(Core& core, const Position& pos) {
+    if (read_side(core) != pos.side()) PANIC("write_position(): side must match the game's current turn");
+
+    std::array<u8, 11 * 11> buf_com;
+    std::array<u8, 11 * 11> buf_hum;
+    for (const auto sq : Sq::sqs_ok()) {
+        // 盤外は常に壁
+        const auto cell = sq.is_valid() ? pos.board()[sq] : Cell { CellWall {} };
+        if (sq.is_valid() && std::holds_alternative<CellWall>(cell)) PANIC("write_position(): wall on the board: ({}, {})", sq.x(), sq.y());
+        std::tie(buf_com[sq.get()], buf_hum[sq.get()]) = encode_cell(cell);
+    }
+    core.write_bytes(ADDR_BOARD_COM, buf_com.begin(), buf_com.end());
+    core.write_bytes(ADDR_BOARD_HUM, buf_hum.begin(), buf_hum.end());
+
+    write_hand(core, ADDR_HAND_COM, pos.hand_com());
+    write_hand(core, ADDR_HAND_HUM, pos.hand_hum());
+
+    if (read_position(core).hash() != pos.hash()) PANIC("write_position(): read-back mismatch");
+}
+
+//--------------------------------------------------------------------
+// PositionTracker
+//--------------------------------------------------------------------
+
+PositionTracker::PositionTracker(Core& core)
+    : core_(core)
+    , pos_(Side::COM, Board {}, Hand {}, Hand {}) {
+    resync();
+
+    // resync() が PANIC してもフックが残らないよう、登録は最後に行う
+    hooks_.reserve(4);
+    hooks_.push_back(core.hook_on_write(ADDR_BOARD_COM, 11 * 11, [this](u16 addr, u8 value, u16) { on_write_board(addr, value, true); }));
+    hooks_.push_back(core.hook_on_write(ADDR_BOARD_HUM, 11 * 11, [this](u16 addr, u8 value, u16) { on_write_board(addr, value, false); }));
+    hooks_.push_back(core.hook_on_write(ADDR_HAND_HUM, 2 * 7, [this](u16 addr, u8 value, u16) { on_write_hand(addr, value); }));
+    hooks_.push_back(core.hook_on_write(ADDR_SIDE, 1, [this](u16, u8 value, u16) { on_write_side(value); }));
+}
+
+PositionTracker::~PositionTracker() {
+    for (const auto hook : hooks_)
+        core_.unhook_on_write(hook);
+}
+
+const Position& PositionTracker::position() {
+    sync();
+    if (n_torn_ > 0) PANIC("PositionTracker::position(): board arrays are being updated ({} squares)", n_torn_);
+    return pos_;
+}
+
+u64 PositionTracker::hash() {
+    sync();
+    return hash_;
+}
+
+std::vector<Sq> PositionTracker::changed_sqs() {
+    sync();
+
+    std::vector<Sq> sqs;
+    for (const auto sq : touched_sqs_) {
+        const auto i = sq.get();
+        if (bytes_com_[i] != base_com_[i] || bytes_hum_[i] != base_hum_[i]) sqs.push_back(sq);
+    }
+    return sqs;
+}
+
+void PositionTracker::clear_changes() {
+    sync();
+
+    for (const auto sq : touched_sqs_)
+        touched_[sq.get()] = false;
+    touched_sqs_.clear();
+    base_com_ = bytes_com_;
+    base_hum_ = bytes_hum_;
+}
+
+void PositionTracker::resync() {
+    const auto ram = core_.ram();
+
+    // 食い違っているマスは空白とみなしておく (揃った時点で上書きされる)
+    n_torn_ = 0;
+    for (const auto sq : Sq::sqs_ok()) {
+        const auto i = sq.get();
+        bytes_com_[i] = ram[ADDR_BOARD_COM + i];
+        bytes_hum_[i] = ram[ADDR_BOARD_HUM + i];
+
+        const auto cell = decode_cell(bytes_com_[i], bytes_hum_[i]);
+        torn_[i] = !cell;
+        pos_.board_[sq] = cell ? *cell : CellEmpty {};
+        if (!cell) ++n_torn_;
+    }
+
+    for (const auto i : IRANGE(7)) {
+        const auto pt = pts_hand()[i];
+        pos_.hand_hum_[pt] = ram[ADDR_HAND_HUM + i];
+        pos_.hand_com_[pt] = ram[ADDR_HAND_COM + i];
+    }
+
+    pos_.side_ = decode_side(ram[ADDR_SIDE]);
+
+    hash_ = pos_.hash();
+
+    touched_.fill(false);
+    touched_sqs_.clear();
+    base_com_ = bytes_com_;
+    base_hum_ = bytes_hum_;
+
+    epoch_ = core_.state_epoch();
+}
+
+void PositionTracker::on_write_board(const u16 addr, const u8 value, const bool com) {
+    const Sq sq(addr - (com ? ADDR_BOARD_COM : ADDR_BOARD_HUM));
+    const auto i = sq.get();
+
+    auto& bytes = com ? bytes_com_ : bytes_hum_;
+    if (bytes[i] == value) return;
+    bytes[i] = value;
+
+    if (!touched_[i]) {
+        touched_[i] = true;
+        touched_sqs_.push_back(sq);
+    }
+
+    const auto cell = decode_cell(bytes_com_[i], bytes_hum_[i]);
+    if (cell) {
+        hash_ ^= zobrist_cell(sq, pos_.board_[sq]) ^ zobrist_cell(sq, *cell);
+        pos_.board_[sq] = *cell;
+    }
+    set_torn(sq, !cell);
+}
+
+void PositionTracker::on_write_hand(const u16 addr, const u8 value) {
+    const auto i = addr - ADDR_HAND_HUM;
+    const auto side = i < 7 ? Side::HUM : Side::COM;
+    const auto pt = pts_hand()[i % 7];
+    auto& count = (side == Side::HUM ? pos_.hand_hum_ : pos_.hand_com_)[pt];
+
+    hash_ ^= zobrist_hand(side, pt, count) ^ zobrist_hand(side, pt, value);
+    count = value;
+}
+
+void PositionTracker::on_write_side(const u8 value) {
+    const auto side = decode_side(value);
+    hash_ ^= zobrist_side(pos_.side_) ^ zobrist_side(side);
+    pos_.side_ = side;
+}
+
+void PositionTracker::set_torn(const Sq sq, const bool torn) {
+    const auto i = sq.get();
+    if (torn_[i] == torn) return;
+    torn_[i] = torn;
+    n_torn_ += torn ? 1 : -1;
+}
+
 Sq read_cursor(Core& core) {
-    const auto x = core.read_u8(0xD6);
-    const auto y = core.read_u8(0xD7);
+    const auto ram = core.ram();
+    const auto x = ram[0xD6];
+    const auto y = ram[0xD7];
     return Sq::from_xy(x, y);
 }
 
@@ -292,3 +610,191 @@ std::pair<u8, const Buttons*> Traveller::query(int src, int dst) const {
     const auto& entry = entrys_[src][dst];
     return { entry.size, entry.seq.data() };
 }
+
+//--------------------------------------------------------------------
+// CursorPlanner
+//--------------------------------------------------------------------
+
+CursorPlanner CursorPlanner::calibrate(Core& core, const Snapshot& snapshot) {
+    core.snapshot_load(snapshot);
+
+    // A の較正に使う HUM の駒。2 マス動いても盤内に収まる位置から選ぶ
+    const auto board = read_board(core);
+    constexpr auto sqs = Sq::sqs_valid();
+    const auto it_c = std::find_if(sqs.begin(), sqs.end(), [&board](const Sq sq) {
+        return 3 <= sq.x() && sq.x() <= 7 && 3 <= sq.y() && sq.y() <= 7 && std::holds_alternative<CellHum>(board[sq]);
+    });
+    if (it_c == sqs.end()) PANIC("CursorPlanner::calibrate(): no HUM piece inside the board");
+    const auto c = *it_c;
+
+    const auto tra = Traveller::calc();
+
+    // カーソルが c にある状態と、c の各方向の隣にある状態
+    Snapshot at_c;
+    move_cursor_slowly(core, snapshot, tra, c, at_c);
+    std::array<Snapshot, 8> before_c;
+    for (const auto k : IRANGE(8)) {
+        const auto [dy, dx, buttons] = NEIGHBORS[k];
+        move_cursor_slowly(core, snapshot, tra, Sq::from_xy(c.x() - dx, c.y() - dy), before_c[k]);
+    }
+
+    CursorPlanner planner;
+
+    for (const auto i : IRANGE(8)) {
+        for (const auto j : IRANGE(8))
+            planner.gaps_[i][j] = measure_gap(core, at_c, kind_buttons(i), kind_buttons(j));
+    }
+    for (const auto i : IRANGE(8))
+        planner.gaps_[i][KIND_A] = measure_gap(core, before_c[i], kind_buttons(i), OP_A);
+    for (const auto j : IRANGE(8))
+        planner.gaps_[KIND_A][j] = measure_gap(core, at_c, OP_A, kind_buttons(j));
+    // 同じマスで掴んで置くことはまずないので測らない
+    planner.gaps_[KIND_A][KIND_A] = GAP_MAX;
+
+    planner.share_a_ = true;
+    for (const auto k : IRANGE(8)) {
+        const auto buttons = kind_buttons(k);
+        EffectChecker checker(core, before_c[k], inputs_with_gap(buttons, GAP_MAX, OP_A));
+        if (!checker.same_effect({ Buttons(buttons.value() | OP_A.value()) })) {
+            planner.share_a_ = false;
+            break;
+        }
+    }
+
+    core.snapshot_load(snapshot);
+
+    return planner;
+}
+
+CursorPlanner CursorPlanner::load_or_calibrate(Core& core, const Snapshot& snapshot, const std::string& dir_cache) {
+    const auto md5 = core.rom_md5();
+    const auto path = planner_cache_path(dir_cache, md5);
+
+    CursorPlanner planner;
+    if (planner.read_cache(path, md5)) return planner;
+
+    planner = calibrate(core, snapshot);
+    planner.write_cache(path, md5);
+    return planner;
+}
+
+bool CursorPlanner::read_cache(const std::string& path, const std::array<u8, 16>& md5) {
+    std::FILE* const fp = std::fopen(path.c_str(), "rb");
+    if (!fp) return false;
+
+    std::array<char, 4> magic;
+    u8 version;
+    std::array<u8, 16> md5_cache;
+    u8 share_a;
+    const bool ok = std::fread(magic.data(), 1, magic.size(), fp) == magic.size()
+        && std::fread(&version, 1, 1, fp) == 1
+        && std::fread(md5_cache.data(), 1, md5_cache.size(), fp) == md5_cache.size()
+        && std::fread(gaps_.data(), 1, sizeof(gaps_), fp) == sizeof(gaps_)
+        && std::fread(&share_a, 1, 1, fp) == 1;
+    std::fclose(fp);
+
+    // 壊れたキャッシュや別 ROM のものは無視して較正し直す
+    if (!ok || magic != PLANNER_CACHE_MAGIC || version != PLANNER_CACHE_VERSION || md5_cache != md5) return false;
+
+    share_a_ = share_a != 0;
+    return true;
+}
+
+void CursorPlanner::write_cache(const std::string& path, const std::array<u8, 16>& md5) const {
+    std::FILE* const fp = std::fopen(path.c_str(), "wb");
+    if (!fp) PANIC("CursorPlanner: cannot open cache file: {}", path);
+
+    const u8 share_a = share_a_ ? 1 : 0;
+    const bool ok = std::fwrite(PLANNER_CACHE_MAGIC.data(), 1, PLANNER_CACHE_MAGIC.size(), fp) == PLANNER_CACHE_MAGIC.size()
+        && std::fwrite(&PLANNER_CACHE_VERSION, 1, 1, fp) == 1
+        && std::fwrite(md5.data(), 1, md5.size(), fp) == md5.size()
+        && std::fwrite(gaps_.data(), 1, sizeof(gaps_), fp) == sizeof(gaps_)
+        && std::fwrite(&share_a, 1, 1, fp) == 1;
+    if (std::fclose(fp) != 0 || !ok) PANIC("CursorPlanner: cannot write cache file: {}", path);
+}
+
+std::vector<Buttons> CursorPlanner::plan(const int cur, const int src, const int dst) const {
+    static const auto GRAPH = traveller_graph();
+
+    // 状態: (段階, カーソル位置, 最後に押したボタンの種類)
+    // 段階 0: 掴む前, 1: 掴んだ後, 2: 置いた後
+    constexpr int N_LAST = KIND_NONE + 1;
+    const auto state_id = [](const int stage, const int v, const int last) { return (88 * stage + v) * N_LAST + last; };
+    constexpr int N_STATE = 3 * 88 * N_LAST;
+
+    struct Prev {
+        int state { -1 };
+        Buttons buttons {};
+        u8 gap { 0 };
+    };
+
+    std::vector<int> dist(N_STATE, std::numeric_limits<int>::max());
+    std::vector<Prev> prev(N_STATE);
+
+    using Item = std::pair<int, int>; // (フレーム数, 状態)
+    std::priority_queue<Item, std::vector<Item>, std::greater<>> pq;
+
+    const auto relax = [&](const int from, const int last, const int to, const int kind, const Buttons buttons) {
+        const u8 gap = last == KIND_NONE ? 0 : gaps_[last][kind];
+        const int d = dist[from] + gap + 1;
+        if (CHMIN(dist[to], d)) {
+            prev[to] = Prev { from, buttons, gap };
+            pq.emplace(d, to);
+        }
+    };
+
+    const int start = state_id(0, cur, KIND_NONE);
+    dist[start] = 0;
+    pq.emplace(0, start);
+
+    int goal = -1;
+    while (!pq.empty()) {
+        const auto [d, s] = pq.top();
+        pq.pop();
+        if (d != dist[s]) continue;
+
+        const int last = s % N_LAST;
+        const int v = (s / N_LAST) % 88;
+        const int stage = s / N_LAST / 88;
+        if (stage == 2) {
+            goal = s;
+            break;
+        }
+        const int target = stage == 0 ? src : dst;
+
+        for (const auto w : IRANGE(88)) {
+            const auto buttons = GRAPH[v][w];
+            if (buttons.is_empty()) continue;
+            const int kind = buttons_kind(buttons);
+            relax(s, last, state_id(stage, w, kind), kind, buttons);
+            // 最後の移動と A を 1 フレームで
+            if (share_a_ && w == target) relax(s, last, state_id(stage + 1, w, KIND_A), kind, Buttons(buttons.value() | OP_A.value()));
+        }
+
+        if (v == target) relax(s, last, state_id(stage + 1, v, KIND_A), KIND_A, OP_A);
+    }
+    if (goal == -1) PANIC("CursorPlanner::plan(): unreachable: cur={}, src={}, dst={}", cur, src, dst);
+
+    std::vector<Buttons> inputs;
+    for (int s = goal; s != start; s = prev[s].state) {
+        inputs.push_back(prev[s].buttons);
+        inputs.insert(inputs.end(), prev[s].gap, Buttons {});
+    }
+    std::reverse(inputs.begin(), inputs.end());
+
+    return inputs;
+}
+
+std::vector<Buttons> CursorPlanner::plan_hold(const int cur, const int src, const int dst) const {
+    auto inputs = plan(cur, src, dst);
+    const auto last = inputs.back();
+    inputs.pop_back();
+
+    if (last.value() != OP_A.value()) {
+        const auto dir = Buttons(last.value() & ~OP_A.value());
+        inputs.push_back(dir);
+        inputs.insert(inputs.end(), gaps_[buttons_kind(dir)][KIND_A], Buttons {});
+    }
+
+    return inputs;
+}
@@ -1,10 +1,13 @@
 #pragma once
 
 #include <array>
+#include <string>
 #include <type_traits>
 #include <utility>
 #include <variant>
+#include <vector>
 
+#include <boost/core/noncopyable.hpp>
 #include <boost/operators.hpp>
 
 #include "core.hpp"
@@ -32,6 +35,13 @@ enum class Piece {
     PRO_PAWN = 15,
 };
 
+// 局面を表す RAM のアドレス
+constexpr u16 ADDR_SIDE = 0x77; // 0 なら COM の手番
+constexpr u16 ADDR_BOARD_COM = 0x49B; // 11x11 (壁を含む)
+constexpr u16 ADDR_BOARD_HUM = 0x3A9; // 11x11 (壁を含む)
+constexpr u16 ADDR_HAND_HUM = 0x58D; // pts_hand() の順に 7 バイト
+constexpr u16 ADDR_HAND_COM = 0x594; // HUM の持駒の直後
+
 constexpr std::array<Piece, 7> pts_hand() {
     return { Piece::ROOK, Piece::BISHOP, Piece::GOLD, Piece::SILVER, Piece::KNIGHT, Piece::LANCE, Piece::PAWN };
 }
@@ -336,6 +346,8 @@ private:
     Hand hand_com_;
     Hand hand_hum_;
 
+    friend class PositionTracker;
+
 public:
     Position(Side side, const Board& board, const Hand& hand_com, const Hand& hand_hum);
 
@@ -343,16 +355,111 @@ public:
     [[nodiscard]] const Board& board() const;
     [[nodiscard]] const Hand& hand_com() const;
     [[nodiscard]] const Hand& hand_hum() const;
+
+    // Zobrist ハッシュ (zobrist_* の XOR) を一から計算する。
+    [[nodiscard]] u64 hash() const;
 };
 
+// Position の Zobrist ハッシュの成分。局面の一部が変わったら、古い成分と新しい成分を XOR すれば差分更新できる。
+// 乱数表は持たず、添字を splitmix64 で混ぜて作る (持駒の枚数などに上限を設けずに済む)。
+[[nodiscard]] constexpr u64 zobrist_key(const u32 index) {
+    u64 z = u64(index) * 0x9E3779B97F4A7C15 + 0x6A09E667F3BCC909;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    return z ^ (z >> 31);
+}
+
+// 壁と空白マスの成分は 0
+[[nodiscard]] constexpr u64 zobrist_cell(const Sq sq, const Cell& cell) {
+    if (const auto* c = std::get_if<CellCom>(&cell))
+        return zobrist_key(0x00000 + 16 * sq.get() + static_cast<u32>(c->pt));
+    if (const auto* c = std::get_if<CellHum>(&cell))
+        return zobrist_key(0x10000 + 16 * sq.get() + static_cast<u32>(c->pt));
+    return 0;
+}
+
+// 0 枚の成分は 0
+[[nodiscard]] constexpr u64 zobrist_hand(const Side side, const Piece pt, const u8 count) {
+    if (count == 0) return 0;
+    return zobrist_key(0x20000 + 0x1000 * static_cast<u32>(side) + 0x100 * static_cast<u32>(pt) + count);
+}
+
+// COM 手番の成分は 0
+[[nodiscard]] constexpr u64 zobrist_side(const Side side) {
+    return side == Side::HUM ? zobrist_key(0x30000) : 0;
+}
+
 [[nodiscard]] Side read_side(Core& core);
 [[nodiscard]] Board read_board(Core& core);
 [[nodiscard]] Hand read_hand_com(Core& core);
 [[nodiscard]] Hand read_hand_hum(Core& core);
 [[nodiscard]] Position read_position(Core& core);
 
+// pos を盤面 (COM 用, HUM 用の両配列) と両者の持駒に書き込み、読み戻して確かめる。
+// 手番と入力処理の状態 (どちらの指し手を待っているか) は結びついているので書き換えない:
+// core は pos.side() の手番で指し手を待っている状態でなければならない。
+// ゲームが盤面から作って持ち続ける表があるかは分かっていないので、それらは書かない。
+// 画面 (ネームテーブル) は更新されないので、表示は元の局面のまま。
+void write_position(Core& core, const Position& pos);
+
 [[nodiscard]] Sq read_cursor(Core& core);
 
+// 局面を表す RAM (盤面, 持駒, 手番) への CPU の書き込みをフックし、デコード済みの局面と
+// ハッシュを書き込みごとに差分更新する。局面の取得は RAM を読まない。
+//
+// 盤面は COM 用と HUM 用の 2 配列なので、指し手の処理中は片方だけ書き換わった中途半端なマスがありうる。
+// そのマスは両方が揃うまで古いデコード結果のまま保留する (保留中に position() を呼ぶとエラー)。
+// スナップショットのロードなど CPU を経由しない書き換えは Core::state_epoch() で検出し、
+// 次に取得するときに RAM から読み直す (変化したマスの記録もそこで捨てる)。
+class PositionTracker : private boost::noncopyable {
+private:
+    Core& core_;
+    u64 epoch_ { 0 };
+
+    // フック対象の RAM の写し
+    std::array<u8, 11 * 11> bytes_com_ {};
+    std::array<u8, 11 * 11> bytes_hum_ {};
+
+    Position pos_;
+    u64 hash_ { 0 };
+
+    std::array<bool, 11 * 11> torn_ {}; // 2 配列の内容が食い違っているマス
+    int n_torn_ { 0 };
+
+    // clear_changes() 以降に書き込まれたマスと、その時点の値
+    std::array<bool, 11 * 11> touched_ {};
+    std::vector<Sq> touched_sqs_ {};
+    std::array<u8, 11 * 11> base_com_ {};
+    std::array<u8, 11 * 11> base_hum_ {};
+
+    std::vector<HookHandle> hooks_ {};
+
+    void resync();
+    void sync() {
+        if (epoch_ != core_.state_epoch()) resync();
+    }
+
+    void on_write_board(u16 addr, u8 value, bool com);
+    void on_write_hand(u16 addr, u8 value);
+    void on_write_side(u8 value);
+
+    void set_torn(Sq sq, bool torn);
+
+public:
+    explicit PositionTracker(Core& core);
+    ~PositionTracker();
+
+    [[nodiscard]] const Position& position();
+
+    // 局面の Zobrist ハッシュ。保留中のマスは古いデコード結果で数える (保留がなければ position().hash() と同じ)
+    [[nodiscard]] u64 hash();
+
+    // clear_changes() 以降に内容が変わったマス (書き込まれても元の値に戻ったものは含まない)
+    [[nodiscard]] std::vector<Sq> changed_sqs();
+
+    void clear_changes();
+};
+
 // ゲーム画面上の盤面マスおよび持駒マスを頂点とみなし、
 // 全頂点間最短経路(操作列)を計算してキャッシュする
 class Traveller {
@@ -388,3 +495,46 @@ public:
         return 81 + (static_cast<std::underlying_type_t<Piece>>(pt) - 2);
     }
 };
+
+// 指し手入力 (カーソルを src へ動かし A で駒を掴み、dst へ動かして A で置く) の
+// フレーム単位の入力スケジュールを、エミュレートするフレーム数が最小になるように作る。
+//
+// Traveller は 1 操作をコスト 1 とみなすが、実際のコストはフレーム数で、ゲームの入力処理
+// (同じボタンを続けて押すには離す必要がある、など) によってボタンの組み合わせごとに違う。
+// そこで「ボタン i の次にボタン j を押すまでに要る無入力フレーム数」を実機で測り (較正)、
+// それを辺のコストとして最短経路を求める。較正結果は ROM の MD5 ごとにファイルにキャッシュする。
+class CursorPlanner {
+private:
+    // ボタンの種類: 方向 0..7 (Traveller の辺と同じもの), A
+    static constexpr int N_KIND = 9;
+
+    // gaps_[i][j]: 種類 i を押したフレームの後、種類 j を押すまでに要る無入力フレーム数
+    std::array<std::array<u8, N_KIND>, N_KIND> gaps_ {};
+    // 最後の方向と A を同じフレームで押せるか
+    bool share_a_ { false };
+
+    CursorPlanner() = default;
+
+    [[nodiscard]] bool read_cache(const std::string& path, const std::array<u8, 16>& md5);
+    void write_cache(const std::string& path, const std::array<u8, 16>& md5) const;
+
+public:
+    // snapshot は HUM の入力待ちで、カーソルを自由に動かせる状態でなければならない。
+    // 盤の内側 (3 <= x, y <= 7) に HUM の駒が少なくとも 1 つ必要 (A の較正に使う)。
+    // 数千フレーム走らせる。core の状態は snapshot に戻る。
+    [[nodiscard]] static CursorPlanner calibrate(Core& core, const Snapshot& snapshot);
+
+    // dir_cache 下のキャッシュがあれば読み、なければ較正して書き出す。
+    [[nodiscard]] static CursorPlanner load_or_calibrate(Core& core, const Snapshot& snapshot, const std::string& dir_cache);
+
+    // カーソルが cur にある入力待ちの状態から、src で掴んで dst に置くまでの入力 (1 要素 1 フレーム)。
+    // 頂点は Traveller と同じ番号付け。最後の要素は dst での A (を含むフレーム)。
+    [[nodiscard]] std::vector<Buttons> plan(int cur, int src, int dst) const;
+
+    // plan() から dst に置く A を除いたもの。A だけを 1 フレーム押せば置ける状態で終わる
+    // (最後の移動と A を同じフレームで押す計画なら、移動だけ押して A に必要な間隔を空ける)。
+    [[nodiscard]] std::vector<Buttons> plan_hold(int cur, int src, int dst) const;
+
+    [[nodiscard]] u8 gap(int kind_prev, int kind_next) const { return gaps_[kind_prev][kind_next]; }
+    [[nodiscard]] bool share_a() const { return share_a_; }
+};
@@ -0,0 +1,229 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "movegen.hpp"
+#include "naitou.hpp"
+#include "notation.hpp"
+#include "prelude.hpp"
+
+namespace {
+
+// HUM の駒の表記 (COM は小文字にする)
+constexpr std::array<std::pair<Piece, std::string_view>, 14> PIECE_STRS = { {
+    { Piece::KING, "K" },
+    { Piece::ROOK, "R" },
+    { Piece::BISHOP, "B" },
+    { Piece::GOLD, "G" },
+    { Piece::SILVER, "S" },
+    { Piece::KNIGHT, "N" },
+    { Piece::LANCE, "L" },
+    { Piece::PAWN, "P" },
+    { Piece::DRAGON, "+R" },
+    { Piece::HORSE, "+B" },
+    { Piece::PRO_SILVER, "+S" },
+    { Piece::PRO_KNIGHT, "+N" },
+    { Piece::PRO_LANCE, "+L" },
+    { Piece::PRO_PAWN, "+P" },
+} };
+
+std::string piece_str(const Piece pt, const Side side) {
+    for (const auto& [p, s] : PIECE_STRS) {
+        if (p != pt) continue;
+        std::string res(s);
+        if (side == Side::COM) res.back() = char(std::tolower(res.back()));
+        return res;
+    }
+    PANIC("piece_str(): unknown piece: {}", static_cast<int>(pt));
+}
+
+// s が HUM の表記 (大文字) で表す駒
+std::optional<Piece> piece_from_str(const std::string_view s) {
+    for (const auto& [p, str] : PIECE_STRS) {
+        if (str == s) return p;
+    }
+    return std::nullopt;
+}
+
+std::optional<Piece> hand_piece_from_char(const char c) {
+    const auto pt = piece_from_str(std::string_view(&c, 1));
+    if (!pt || *pt == Piece::KING) return std::nullopt;
+    return pt;
+}
+
+std::string sq_str(const Sq sq) {
+    return { char('0' + sq.x()), char('a' + sq.y() - 1) };
+}
+
+std::optional<Sq> sq_from_str(const std::string_view s) {
+    if (s.size() != 2) return std::nullopt;
+    const int x = s[0] - '0';
+    const int y = s[1] - 'a' + 1;
+    if (!(1 <= x && x <= 9 && 1 <= y && y <= 9)) return std::nullopt;
+    return Sq::from_xy(x, y);
+}
+
+std::optional<Board> parse_board(const std::string_view s) {
+    Board board;
+    for (const auto sq : Sq::sqs_valid())
+        board[sq] = CellEmpty {};
+
+    int y = 1;
+    int x = 9;
+    for (std::size_t i = 0; i < s.size(); ++i) {
+        const char c = s[i];
+        if (c == '/') {
+            if (x != 0 || y == 9) return std::nullopt;
+            ++y;
+            x = 9;
+            continue;
+        }
+        if ('1' <= c && c <= '9') {
+            x -= c - '0';
+            if (x < 0) return std::nullopt;
+            continue;
+        }
+
+        std::string str;
+        if (c == '+') {
+            if (++i == s.size()) return std::nullopt;
+            str += '+';
+        }
+        const char letter = s[i];
+        if (!std::isalpha(static_cast<unsigned char>(letter))) return std::nullopt;
+        str += char(std::toupper(letter));
+
+        const auto pt = piece_from_str(str);
+        if (!pt || x < 1) return std::nullopt;
+        const auto sq = Sq::from_xy(x--, y);
+        if (std::isupper(static_cast<unsigned char>(letter)))
+            board[sq] = CellHum { *pt };
+        else
+            board[sq] = CellCom { *pt };
+    }
+    if (x != 0 || y != 9) return std::nullopt;
+
+    return board;
+}
+
+// (COM の持駒, HUM の持駒)
+std::optional<std::pair<Hand, Hand>> parse_hands(const std::string_view s) {
+    Hand hand_com;
+    Hand hand_hum;
+    if (s == "-") return std::pair { hand_com, hand_hum };
+
+    int count = 0;
+    for (const char c : s) {
+        if (std::isdigit(static_cast<unsigned char>(c))) {
+            count = 10 * count + (c - '0');
+            if (count > 18) return std::nullopt;
+            continue;
+        }
+        const auto pt = hand_piece_from_char(char(std::toupper(c)));
+        if (!pt) return std::nullopt;
+        auto& hand = std::isupper(static_cast<unsigned char>(c)) ? hand_hum : hand_com;
+        hand[*pt] = u8(count == 0 ? 1 : count);
+        count = 0;
+    }
+    if (count != 0) return std::nullopt;
+
+    return std::pair { hand_com, hand_hum };
+}
+
+} // anonymous namespace
+
+std::string format_position(const Position& pos) {
+    std::string res;
+
+    for (const auto y : IRANGE(1, 10)) {
+        if (y > 1) res += '/';
+        int n_empty = 0;
+        for (int x = 9; x >= 1; --x) {
+            const auto& cell = pos.board()[Sq::from_xy(x, y)];
+            const auto* com = std::get_if<CellCom>(&cell);
+            const auto* hum = std::get_if<CellHum>(&cell);
+            if (!com && !hum) {
+                ++n_empty;
+                continue;
+            }
+            if (n_empty > 0) res += char('0' + n_empty);
+            n_empty = 0;
+            res += com ? piece_str(com->pt, Side::COM) : piece_str(hum->pt, Side::HUM);
+        }
+        if (n_empty > 0) res += char('0' + n_empty);
+    }
+
+    res += pos.side() == Side::HUM ? " b " : " w ";
+
+    std::string hands;
+    for (const auto& [side, hand] : { std::pair { Side::HUM, pos.hand_hum() }, std::pair { Side::COM, pos.hand_com() } }) {
+        for (const auto pt : pts_hand()) {
+            const auto n = hand[pt];
+            if (n == 0) continue;
+            if (n > 1) hands += std::to_string(n);
+            hands += piece_str(pt, side);
+        }
+    }
+    res += hands.empty() ? "-" : hands;
+
+    return res;
+}
+
+std::optional<Position> parse_position(const std::string_view s) {
+    const auto sp1 = s.find(' ');
+    if (sp1 == std::string_view::npos) return std::nullopt;
+    const auto sp2 = s.find(' ', sp1 + 1);
+    if (sp2 == std::string_view::npos) return std::nullopt;
+
+    const auto board = parse_board(s.substr(0, sp1));
+    if (!board) return std::nullopt;
+
+    const auto side_str = s.substr(sp1 + 1, sp2 - sp1 - 1);
+    if (side_str != "b" && side_str != "w") return std::nullopt;
+    const auto side = side_str == "b" ? Side::HUM : Side::COM;
+
+    // SFEN の手数は読み捨てる
+    auto hands_str = s.substr(sp2 + 1);
+    if (const auto sp3 = hands_str.find(' '); sp3 != std::string_view::npos) {
+        const auto ply = hands_str.substr(sp3 + 1);
+        if (ply.empty() || !std::all_of(ply.begin(), ply.end(), [](const char c) { return std::isdigit(static_cast<unsigned char>(c)); })) return std::nullopt;
+        hands_str = hands_str.substr(0, sp3);
+    }
+    const auto hands = parse_hands(hands_str);
+    if (!hands) return std::nullopt;
+
+    return Position(side, *board, hands->first, hands->second);
+}
+
+std::string format_move(const Move& mv) {
+    if (mv.is_drop()) return piece_str(mv.pt, Side::HUM) + '*' + sq_str(mv.dst);
+    return sq_str(mv.src) + sq_str(mv.dst) + (mv.promote ? "+" : "");
+}
+
+std::optional<Move> parse_move(const Position& pos, std::string_view s) {
+    std::optional<Move> target;
+    if (s.size() == 4 && s[1] == '*') {
+        const auto pt = hand_piece_from_char(s[0]);
+        const auto dst = sq_from_str(s.substr(2));
+        if (!pt || !dst) return std::nullopt;
+        target = Move::drop(*pt, *dst);
+    }
+    else {
+        const bool promote = !s.empty() && s.back() == '+';
+        if (promote) s.remove_suffix(1);
+        if (s.size() != 4) return std::nullopt;
+        const auto src = sq_from_str(s.substr(0, 2));
+        const auto dst = sq_from_str(s.substr(2));
+        if (!src || !dst) return std::nullopt;
+        target = Move::board(Piece::KING, *src, *dst, promote); // 駒種は合法手から決める
+    }
+
+    for (const auto& mv : legal_moves(pos)) {
+        if (mv.src == target->src && mv.dst == target->dst && mv.promote == target->promote && (!mv.is_drop() || mv.pt == target->pt)) return mv;
+    }
+    return std::nullopt;
+}
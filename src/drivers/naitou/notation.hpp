@@ -0,0 +1,31 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "movegen.hpp"
+#include "naitou.hpp"
+
+// 局面と指し手の 1 行表記 (SFEN/USI に倣う)。
+//
+// 局面: "<盤面> <手番> <持駒>"
+//   盤面: 段 y = 1..9 を '/' で区切り、各段は筋 x = 9..1 の順。HUM の駒は大文字、COM の駒は小文字、
+//         成駒は '+' を前置し、連続する空きマスはその数。
+//   手番: 'b' (HUM) または 'w' (COM)。
+//   持駒: 枚数 (1 枚なら省略) と駒の文字の並び (HUM は大文字, COM は小文字)。なければ '-'。
+//   駒の文字: K R B G S N L P
+//   SFEN の末尾の手数はあってもよい (読み捨てる)。
+//
+// 指し手: 盤上の手は "<src><dst>" に成るなら '+' を付ける。駒打ちは "<駒>*<dst>" (駒は大文字)。
+//   マスは筋の数字と段の文字 ('a' が y = 1)。例: "7g7f", "8h2b+", "P*5e"
+
+[[nodiscard]] std::string format_position(const Position& pos);
+
+// 表記として不正なら std::nullopt (局面として正しいか (玉の数など) は見ない)。
+[[nodiscard]] std::optional<Position> parse_position(std::string_view s);
+
+[[nodiscard]] std::string format_move(const Move& mv);
+
+// pos の手番側の合法手のうち s が表すもの。不正または非合法なら std::nullopt。
+[[nodiscard]] std::optional<Move> parse_move(const Position& pos, std::string_view s);
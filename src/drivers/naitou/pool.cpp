@@ -0,0 +1,405 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <new>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "core.hpp"
+#include "pool.hpp"
+#include "prelude.hpp"
+
+// 共有メモリ上の SPSC リングバッファ。
+// head/tail は単調増加するバイト位置で、実際の位置は capacity で割った余り。
+// メッセージは (u32 長さ, 本体) の並び。長さ 0 のジョブはワーカーへの終了指示。
+struct WorkerPool::Ring {
+    alignas(64) std::atomic<u64> head; // 書き込み位置 (producer のみ更新)
+    alignas(64) std::atomic<u64> tail; // 読み込み位置 (consumer のみ更新)
+    u64 capacity;
+
+    explicit Ring(const u64 capacity)
+        : head(0)
+        , tail(0)
+        , capacity(capacity) {}
+
+    [[nodiscard]] u8* buf() { return reinterpret_cast<u8*>(this + 1); }
+};
+
+static_assert(std::atomic<u64>::is_always_lock_free, "shared-memory rings need address-free atomics");
+
+namespace {
+
+using Ring = WorkerPool::Ring;
+
+void ring_copy_in(Ring& ring, const u64 pos, const u8* src, const std::size_t size) {
+    const auto ofs = pos % ring.capacity;
+    const auto n = std::min<u64>(size, ring.capacity - ofs);
+    std::memcpy(ring.buf() + ofs, src, n);
+    std::memcpy(ring.buf(), src + n, size - n);
+}
+
+void ring_copy_out(Ring& ring, const u64 pos, u8* dst, const std::size_t size) {
+    const auto ofs = pos % ring.capacity;
+    const auto n = std::min<u64>(size, ring.capacity - ofs);
+    std::memcpy(dst, ring.buf() + ofs, n);
+    std::memcpy(dst + n, ring.buf(), size - n);
+}
+
+bool ring_try_push(Ring& ring, const std::vector<u8>& msg) {
+    const u32 size = msg.size();
+    const u64 need = sizeof(size) + size;
+    if (need > ring.capacity) PANIC("ring_try_push(): message too large: {} bytes", size);
+
+    const auto head = ring.head.load(std::memory_order_relaxed);
+    const auto tail = ring.tail.load(std::memory_order_acquire);
+    if (ring.capacity - (head - tail) < need) return false;
+
+    ring_copy_in(ring, head, reinterpret_cast<const u8*>(&size), sizeof(size));
+    ring_copy_in(ring, head + sizeof(size), msg.data(), size);
+    ring.head.store(head + need, std::memory_order_release);
+
+    return true;
+}
+
+bool ring_try_pop(Ring& ring, std::vector<u8>& msg) {
+    const auto tail = ring.tail.load(std::memory_order_relaxed);
+    const auto head = ring.head.load(std::memory_order_acquire);
+    if (head == tail) return false;
+
+    u32 size;
+    ring_copy_out(ring, tail, reinterpret_cast<u8*>(&size), sizeof(size));
+    msg.resize(size);
+    ring_copy_out(ring, tail + sizeof(size), msg.data(), size);
+    ring.tail.store(tail + sizeof(size) + size, std::memory_order_release);
+
+    return true;
+}
+
+// 待ち時間が長くなったら CPU を手放す
+class Backoff {
+private:
+    int count_ { 0 };
+
+public:
+    // 眠ったら true を返す
+    bool wait() {
+        if (count_ < 64) {
+            ++count_;
+            std::this_thread::yield();
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+        return true;
+    }
+};
+
+class ByteWriter {
+private:
+    std::vector<u8> buf_ {};
+
+public:
+    template <class T>
+    void put(const T& x) {
+        const auto p = reinterpret_cast<const u8*>(&x);
+        buf_.insert(buf_.end(), p, p + sizeof(T));
+    }
+
+    void put_bytes(const u8* data, const std::size_t size) {
+        put<u32>(size);
+        buf_.insert(buf_.end(), data, data + size);
+    }
+
+    [[nodiscard]] const std::vector<u8>& bytes() const { return buf_; }
+};
+
+class ByteReader {
+private:
+    const std::vector<u8>& buf_;
+    std::size_t pos_ { 0 };
+
+public:
+    explicit ByteReader(const std::vector<u8>& buf)
+        : buf_(buf) {}
+
+    template <class T>
+    T get() {
+        if (pos_ + sizeof(T) > buf_.size()) PANIC("ByteReader::get(): truncated message");
+        T x;
+        std::memcpy(&x, buf_.data() + pos_, sizeof(T));
+        pos_ += sizeof(T);
+        return x;
+    }
+
+    // (先頭ポインタ, サイズ) を返す
+    std::pair<const u8*, std::size_t> get_bytes() {
+        const auto size = get<u32>();
+        if (pos_ + size > buf_.size()) PANIC("ByteReader::get_bytes(): truncated message");
+        const auto p = buf_.data() + pos_;
+        pos_ += size;
+        return { p, size };
+    }
+};
+
+std::vector<u8> encode_job(const u64 id, const PoolJob& job) {
+    ByteWriter out;
+    out.put(id);
+    out.put_bytes(job.snapshot->data(), job.snapshot->size());
+    out.put<u32>(job.writes.size());
+    for (const auto& [addr, value] : job.writes) {
+        out.put(addr);
+        out.put(value);
+    }
+    out.put<u32>(job.inputs.size());
+    for (const auto buttons : job.inputs)
+        out.put(buttons.value());
+    out.put<u32>(job.waits.size());
+    for (const auto& wait : job.waits) {
+        out.put(wait.addr);
+        out.put(wait.value);
+        out.put<u8>(wait.equal);
+    }
+    out.put(job.max_wait_frames);
+    out.put<u32>(job.addrs.size());
+    for (const auto addr : job.addrs)
+        out.put(addr);
+    out.put<u8>(job.want_snapshot);
+    return out.bytes();
+}
+
+PoolResult decode_result(const std::vector<u8>& msg) {
+    ByteReader in(msg);
+
+    PoolResult result;
+    result.id = in.get<u64>();
+    result.ok = in.get<u8>() != 0;
+    const auto [p, size] = in.get_bytes();
+    if (result.ok) {
+        result.values.assign(p, p + size);
+        result.wait_frames = in.get<u32>();
+        result.timed_out = in.get<u8>() != 0;
+        const auto [snap, snap_size] = in.get_bytes();
+        result.snapshot.assign(snap, snap + snap_size);
+    }
+    else {
+        result.error.assign(reinterpret_cast<const char*>(p), size);
+    }
+
+    return result;
+}
+
+// ジョブを 1 つ実行し、結果メッセージを返す
+std::vector<u8> run_job(Core& core, Snapshot& snapshot, const std::vector<u8>& msg) {
+    ByteReader in(msg);
+    const auto id = in.get<u64>();
+
+    ByteWriter out;
+    out.put(id);
+    try {
+        const auto [snap, snap_size] = in.get_bytes();
+        snapshot.assign(snap, snap_size);
+        core.snapshot_load(snapshot);
+
+        const auto n_write = in.get<u32>();
+        LOOP(n_write) {
+            const auto addr = in.get<u16>();
+            core.write_u8(addr, in.get<u8>());
+        }
+
+        const auto n_input = in.get<u32>();
+        LOOP(n_input) {
+            core.run_frame(Buttons(in.get<u8>()));
+        }
+
+        const auto n_wait = in.get<u32>();
+        std::vector<PoolWait> waits;
+        LOOP(n_wait) {
+            const auto addr = in.get<u16>();
+            const auto value = in.get<u8>();
+            waits.push_back({ addr, value, in.get<u8>() != 0 });
+        }
+        const auto max_wait_frames = in.get<u32>();
+
+        u32 wait_frames = 0;
+        bool timed_out = false;
+        for (const auto& wait : waits) {
+            while (!timed_out && (core.read_u8(wait.addr) == wait.value) != wait.equal) {
+                if (wait_frames == max_wait_frames) {
+                    timed_out = true;
+                    break;
+                }
+                core.run_frame();
+                ++wait_frames;
+            }
+        }
+
+        const auto n_addr = in.get<u32>();
+        std::vector<u8> values(n_addr);
+        for (auto& value : values)
+            value = core.read_u8(in.get<u16>());
+
+        const bool want_snapshot = in.get<u8>() != 0;
+        if (want_snapshot) core.snapshot_save(snapshot);
+
+        out.put<u8>(1);
+        out.put_bytes(values.data(), values.size());
+        out.put(wait_frames);
+        out.put<u8>(timed_out);
+        if (want_snapshot)
+            out.put_bytes(snapshot.data(), snapshot.size());
+        else
+            out.put_bytes(nullptr, 0);
+    }
+    catch (const std::exception& e) {
+        const std::string what = e.what();
+        out.put<u8>(0);
+        out.put_bytes(reinterpret_cast<const u8*>(what.data()), what.size());
+    }
+
+    return out.bytes();
+}
+
+[[noreturn]] void worker_main(Core& core, Ring& jobs, Ring& results) {
+    Snapshot snapshot;
+    std::vector<u8> msg;
+
+    for (;;) {
+        for (Backoff backoff; !ring_try_pop(jobs, msg);)
+            backoff.wait();
+        if (msg.empty()) break;
+
+        const auto res = run_job(core, snapshot, msg);
+        for (Backoff backoff; !ring_try_push(results, res);)
+            backoff.wait();
+    }
+
+    // 親から引き継いだ資源の後始末は親に任せる
+    _exit(0);
+}
+
+} // anonymous namespace
+
+WorkerPool::WorkerPool(Core& core, const int n_worker, const std::size_t ring_capacity) {
+    if (n_worker <= 0) PANIC("WorkerPool::WorkerPool(): invalid worker count: {}", n_worker);
+
+    // 2 つ目のリングのヘッダもキャッシュライン境界に置く
+    const auto ring_size = (sizeof(Ring) + ring_capacity + 63) / 64 * 64;
+    const auto shm_size = 2 * ring_size;
+
+    for (const auto i : IRANGE(n_worker)) {
+        void* shm = mmap(nullptr, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (shm == MAP_FAILED) PANIC("WorkerPool::WorkerPool(): mmap() failed");
+
+        auto* jobs = new (shm) Ring(ring_capacity);
+        auto* results = new (static_cast<u8*>(shm) + ring_size) Ring(ring_capacity);
+
+        const pid_t pid = fork();
+        if (pid < 0) PANIC("WorkerPool::WorkerPool(): fork() failed (worker {})", i);
+        if (pid == 0) worker_main(core, *jobs, *results);
+
+        workers_.push_back({ pid, shm, shm_size, jobs, results, 0 });
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    // 終了指示を送る。ワーカーが結果リングで詰まらないよう、その間も結果は読み捨てる。
+    const std::vector<u8> stop;
+    std::vector<u8> msg;
+    for (auto& worker : workers_) {
+        for (Backoff backoff; !ring_try_push(*worker.jobs, stop);) {
+            while (ring_try_pop(*worker.results, msg)) {}
+            backoff.wait();
+        }
+    }
+
+    for (auto& worker : workers_) {
+        for (;;) {
+            while (ring_try_pop(*worker.results, msg)) {}
+            int status;
+            const auto ret = waitpid(worker.pid, &status, WNOHANG);
+            if (ret != 0) break;
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        munmap(worker.shm, worker.shm_size);
+    }
+}
+
+u64 WorkerPool::submit(const PoolJob& job) {
+    if (!job.snapshot) PANIC("WorkerPool::submit(): no snapshot");
+
+    const auto id = next_id_++;
+    const auto msg = encode_job(id, job);
+
+    // 最も暇なワーカーに投げる
+    const auto it = std::min_element(workers_.begin(), workers_.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.in_flight < rhs.in_flight;
+    });
+    auto& worker = *it;
+
+    std::vector<u8> res;
+    for (Backoff backoff; !ring_try_push(*worker.jobs, msg);) {
+        // ワーカーが結果リングで詰まっているかもしれないので、待つ間に回収しておく
+        while (ring_try_pop(*worker.results, res)) {
+            --worker.in_flight;
+            pending_.push_back(decode_result(res));
+        }
+        if (backoff.wait()) check_workers();
+    }
+
+    ++worker.in_flight;
+    ++in_flight_;
+
+    return id;
+}
+
+PoolResult WorkerPool::receive() {
+    if (in_flight_ == 0) PANIC("WorkerPool::receive(): no job in flight");
+
+    PoolResult result;
+    for (Backoff backoff; !try_receive(result);) {
+        if (backoff.wait()) check_workers();
+    }
+
+    return result;
+}
+
+bool WorkerPool::try_receive(PoolResult& result) {
+    if (!pending_.empty()) {
+        result = std::move(pending_.front());
+        pending_.pop_front();
+        --in_flight_;
+        return true;
+    }
+
+    std::vector<u8> msg;
+    const auto n = workers_.size();
+    for (const auto i : IRANGE(n)) {
+        auto& worker = workers_[(next_worker_ + i) % n];
+        if (!ring_try_pop(*worker.results, msg)) continue;
+
+        next_worker_ = (next_worker_ + i + 1) % n;
+        --worker.in_flight;
+        --in_flight_;
+        result = decode_result(msg);
+        return true;
+    }
+
+    return false;
+}
+
+void WorkerPool::check_workers() {
+    for (const auto& worker : workers_) {
+        int status;
+        if (waitpid(worker.pid, &status, WNOHANG) != 0)
+            PANIC("WorkerPool: worker {} exited unexpectedly", worker.pid);
+    }
+}
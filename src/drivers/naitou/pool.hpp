@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+
+#include <boost/core/noncopyable.hpp>
+
+#include "core.hpp"
+#include "prelude.hpp"
+
+// (RAM[addr] == value) == equal になるまで無入力でフレームを進める
+struct PoolWait {
+    u16 addr;
+    u8 value;
+    bool equal { true };
+};
+
+// ワーカーに投げるジョブ。
+// snapshot をロードし、writes を書き込み、inputs を 1 フレームずつ流し、waits を順に待った後、addrs の各アドレスを読んで返す。
+struct PoolJob {
+    const Snapshot* snapshot { nullptr };
+    std::vector<std::pair<u16, u8>> writes {}; // (アドレス, 値)
+    std::vector<Buttons> inputs {};
+    std::vector<PoolWait> waits {};
+    u32 max_wait_frames { 0 }; // waits 全体で待つフレーム数の上限
+    std::vector<u16> addrs {};
+    bool want_snapshot { false }; // 最後の状態のスナップショットを返すか
+};
+
+struct PoolResult {
+    u64 id { 0 };
+    bool ok { false };
+    std::vector<u8> values {}; // addrs と同じ順
+    u32 wait_frames { 0 }; // waits で進めたフレーム数
+    bool timed_out { false }; // waits が max_wait_frames 以内に成立しなかった (values などはその時点のもの)
+    std::vector<u8> snapshot {}; // want_snapshot なら Snapshot::assign() に渡せるバイト列
+    std::string error {}; // ok でないときのメッセージ
+};
+
+// fork によるワーカープール。
+//
+// 親は ROM ロードや途中までのプレイを済ませた Core を渡す。ワーカーはその時点の
+// プロセスイメージを copy-on-write で共有するので、初期化をやり直す必要はない。
+// ジョブと結果はワーカーごとの共有メモリ上のリングバッファ (SPSC, ロックフリー) でやりとりする。
+//
+// fork するので、他のスレッドが Core を使っている間に構築してはならない。
+class WorkerPool : private boost::noncopyable {
+public:
+    struct Ring;
+
+private:
+    struct Worker {
+        pid_t pid;
+        void* shm;
+        std::size_t shm_size;
+        Ring* jobs;
+        Ring* results;
+        std::size_t in_flight;
+    };
+
+    std::vector<Worker> workers_ {};
+    std::deque<PoolResult> pending_ {}; // submit() 中に回収した結果
+    u64 next_id_ { 0 };
+    std::size_t in_flight_ { 0 };
+    std::size_t next_worker_ { 0 };
+
+    // 異常終了したワーカーがいれば PANIC
+    void check_workers();
+
+public:
+    // ring_capacity: ワーカーごとのジョブ/結果リングそれぞれの容量 (バイト)
+    WorkerPool(Core& core, int n_worker, std::size_t ring_capacity = 4 << 20);
+    ~WorkerPool();
+
+    [[nodiscard]] int worker_count() const { return static_cast<int>(workers_.size()); }
+
+    // 未回収の結果の数
+    [[nodiscard]] std::size_t in_flight() const { return in_flight_; }
+
+    // ジョブを投げ、ジョブ ID を返す。リングが満杯なら空くまで待つ。
+    u64 submit(const PoolJob& job);
+
+    // 結果を 1 つ回収する (完了順)。未回収のジョブがなければ PANIC。
+    [[nodiscard]] PoolResult receive();
+
+    // 結果があれば回収して true を返す。
+    [[nodiscard]] bool try_receive(PoolResult& result);
+};
@@ -97,7 +97,7 @@ inline void EPRINTLN_IMPL(const S& format_str, Args&&... args) {
 
 namespace detail {
 template <class S, class... Args>
-inline void PANIC_IMPL(const std::string_view file, const int line, const S& format_str, Args&&... args) {
+[[noreturn]] inline void PANIC_IMPL(const std::string_view file, const int line, const S& format_str, Args&&... args) {
     throw std::logic_error(FORMAT("[{}:{}]: PANIC: {}", file, line, FORMAT_IMPL(format_str, std::forward<Args>(args)...)));
 }
 } // namespace detail
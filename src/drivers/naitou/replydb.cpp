@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "types.h"
+#include "utils/crc32.h"
+
+#include "movegen.hpp"
+#include "prelude.hpp"
+#include "replydb.hpp"
+
+namespace {
+
+constexpr std::array<char, 4> MAGIC = { 'N', 'R', 'D', 'B' };
+constexpr u32 VERSION = 2; // 2: frames から入力のフレーム数を除いた
+
+struct Header {
+    std::array<char, 4> magic;
+    u32 version;
+    u64 record_size;
+};
+
+struct Record {
+    u64 hash;
+    u64 hash_child;
+    u64 snapshot_ref;
+    u32 human; // Move::pack()
+    u32 com; // Move::pack() (FLAG_HAS_COM のとき)
+    u32 frames;
+    u32 flags;
+    u32 reserved;
+    u32 crc; // ここより前の CRC32
+};
+
+static_assert(sizeof(Header) == 16);
+static_assert(sizeof(Record) == 48);
+
+constexpr u32 FLAG_TIMED_OUT = 1 << 0;
+constexpr u32 FLAG_HAS_COM = 1 << 1;
+constexpr u32 FLAG_HAS_SNAPSHOT = 1 << 2;
+
+constexpr std::size_t MAP_SIZE_MIN = 1 << 20;
+
+u32 record_crc(const Record& r) {
+    return CalcCRC32(0, reinterpret_cast<uint8*>(const_cast<Record*>(&r)), offsetof(Record, crc));
+}
+
+std::size_t file_size(const int fd, const std::string& path) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) PANIC("ReplyDb: fstat() failed: {}", path);
+    return st.st_size;
+}
+
+} // anonymous namespace
+
+ReplyDb::ReplyDb(std::string path, const Mode mode)
+    : path_(std::move(path))
+    , mode_(mode) {
+    fd_ = mode_ == Mode::Write ? open(path_.c_str(), O_RDWR | O_CREAT, 0644) : open(path_.c_str(), O_RDONLY);
+    if (fd_ < 0) PANIC("ReplyDb: cannot open: {}", path_);
+
+    if (mode_ == Mode::Write) {
+        if (flock(fd_, LOCK_EX | LOCK_NB) != 0) PANIC("ReplyDb: another writer has the database open: {}", path_);
+
+        // 新しいファイルか、前回の書き手がヘッダを書きかけで落ちたファイル
+        // (後者を scan() 後の切り詰めに任せるとヘッダのない空ファイルになる)
+        if (file_size(fd_, path_) < sizeof(Header)) {
+            const Header header { MAGIC, VERSION, sizeof(Record) };
+            if (ftruncate(fd_, 0) != 0 || pwrite(fd_, &header, sizeof(header), 0) != sizeof(header) || fsync(fd_) != 0)
+                PANIC("ReplyDb: cannot write header: {}", path_);
+        }
+    }
+
+    scan();
+
+    // 前回の書き手が書きかけで落ちた分を捨てる
+    if (mode_ == Mode::Write && file_size(fd_, path_) > end_) {
+        if (ftruncate(fd_, end_) != 0) PANIC("ReplyDb: ftruncate() failed: {}", path_);
+    }
+}
+
+ReplyDb::~ReplyDb() {
+    if (map_) munmap(const_cast<u8*>(map_), map_size_);
+    close(fd_);
+}
+
+void ReplyDb::remap(const std::size_t size) {
+    if (size <= map_size_) return;
+
+    // ファイル末尾より先も map しておき、追記のたびに map し直さずに済ませる (末尾より先には触れない)
+    const auto new_size = std::max({ size, 2 * map_size_, MAP_SIZE_MIN });
+    void* p = mmap(nullptr, new_size, PROT_READ, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) PANIC("ReplyDb: mmap() failed: {}", path_);
+
+    if (map_) munmap(const_cast<u8*>(map_), map_size_);
+    map_ = static_cast<const u8*>(p);
+    map_size_ = new_size;
+}
+
+std::size_t ReplyDb::scan() {
+    const auto size = file_size(fd_, path_);
+
+    // 書き手がまだヘッダを書いていない
+    if (size < sizeof(Header)) return 0;
+
+    remap(size);
+
+    if (end_ == 0) {
+        Header header;
+        std::memcpy(&header, map_, sizeof(header));
+        if (header.magic != MAGIC || header.version != VERSION || header.record_size != sizeof(Record))
+            PANIC("ReplyDb: not a reply database (or incompatible version): {}", path_);
+        end_ = sizeof(Header);
+    }
+
+    std::size_t n = 0;
+    for (; end_ + sizeof(Record) <= size; end_ += sizeof(Record)) {
+        Record r;
+        std::memcpy(&r, map_ + end_, sizeof(r));
+        // 書きかけ (読み手なら書き手が追記中, 書き手なら前回の異常終了)
+        if (r.crc != record_crc(r)) break;
+
+        index_[Key { r.hash, r.human }] = end_;
+        ++n;
+    }
+
+    return n;
+}
+
+std::size_t ReplyDb::refresh() {
+    return scan();
+}
+
+std::optional<ReplyEntry> ReplyDb::find(const u64 hash, const Move& human) const {
+    const auto it = index_.find(Key { hash, human.pack() });
+    if (it == index_.end()) return std::nullopt;
+
+    Record r;
+    std::memcpy(&r, map_ + it->second, sizeof(r));
+
+    ReplyEntry entry {};
+    if (r.flags & FLAG_HAS_COM) entry.com = Move::unpack(r.com);
+    entry.frames = r.frames;
+    entry.timed_out = (r.flags & FLAG_TIMED_OUT) != 0;
+    entry.hash_child = r.hash_child;
+    if (r.flags & FLAG_HAS_SNAPSHOT) entry.snapshot_ref = r.snapshot_ref;
+
+    return entry;
+}
+
+void ReplyDb::append(const u64 hash, const Move& human, const ReplyEntry& entry) {
+    if (mode_ != Mode::Write) PANIC("ReplyDb::append(): opened read-only: {}", path_);
+
+    Record r {};
+    r.hash = hash;
+    r.hash_child = entry.hash_child;
+    r.snapshot_ref = entry.snapshot_ref.value_or(0);
+    r.human = human.pack();
+    r.com = entry.com ? entry.com->pack() : 0;
+    r.frames = entry.frames;
+    r.flags = (entry.timed_out ? FLAG_TIMED_OUT : 0) | (entry.com ? FLAG_HAS_COM : 0) | (entry.snapshot_ref ? FLAG_HAS_SNAPSHOT : 0);
+    r.crc = record_crc(r);
+
+    if (pwrite(fd_, &r, sizeof(r), end_) != sizeof(r)) PANIC("ReplyDb::append(): write failed: {}", path_);
+
+    index_[Key { r.hash, r.human }] = end_;
+    end_ += sizeof(r);
+    remap(end_);
+}
+
+void ReplyDb::sync() {
+    if (mode_ != Mode::Write) PANIC("ReplyDb::sync(): opened read-only: {}", path_);
+    if (fdatasync(fd_) != 0) PANIC("ReplyDb::sync(): fdatasync() failed: {}", path_);
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include <boost/core/noncopyable.hpp>
+
+#include "movegen.hpp"
+#include "prelude.hpp"
+
+// (局面, 人間の手) に対する COM の応手
+struct ReplyEntry {
+    std::optional<Move> com; // 応手が特定できなければ std::nullopt
+    u32 frames; // 人間の手の入力を終えてから COM が指し終えるまで (入力の仕方によらない思考時間)
+    bool timed_out;
+    u64 hash_child; // COM の応手後の局面のハッシュ
+    std::optional<u64> snapshot_ref; // 応手後のスナップショットの在処 (意味は利用者が決める)
+};
+
+// (局面のハッシュ, 人間の手) -> ReplyEntry の永続的な表。
+//
+// ファイルは固定長レコードの追記のみで、各レコードは CRC32 を持つ。書き込み途中で落ちても、
+// 末尾の壊れたレコードを無視すれば直前までの内容が残る (書き手として開き直すと切り詰める)。
+// 同じキーが複数あれば後のものが有効。
+//
+// 書き手は 1 プロセスのみ (flock で排他)、読み手は何プロセスでもよい。読み手はファイルを mmap して
+// 索引を作り、refresh() で書き手が後から追記した分を取り込む。
+//
+// スレッドセーフではない。
+class ReplyDb : private boost::noncopyable {
+public:
+    enum class Mode {
+        Read,
+        Write,
+    };
+
+private:
+    struct Key {
+        u64 hash;
+        u32 human;
+
+        friend bool operator==(const Key& lhs, const Key& rhs) {
+            return lhs.hash == rhs.hash && lhs.human == rhs.human;
+        }
+    };
+
+    struct KeyHash {
+        std::size_t operator()(const Key& key) const {
+            // hash は Zobrist ハッシュなので十分散っている
+            return key.hash ^ (u64(key.human) * 0x9E3779B97F4A7C15);
+        }
+    };
+
+    std::string path_;
+    Mode mode_;
+    int fd_ { -1 };
+
+    const u8* map_ { nullptr };
+    std::size_t map_size_ { 0 };
+
+    std::size_t end_ { 0 }; // 検証済みの末尾 (バイト位置)
+    std::unordered_map<Key, std::size_t, KeyHash> index_ {}; // キー -> レコードの位置
+
+    // ファイルの [0, size) を map する
+    void remap(std::size_t size);
+
+    // end_ 以降の完全なレコードを索引に取り込み、その件数を返す
+    std::size_t scan();
+
+public:
+    ReplyDb(std::string path, Mode mode);
+    ~ReplyDb();
+
+    // 読み手: 書き手が追記したレコードを取り込み、その件数を返す。
+    std::size_t refresh();
+
+    [[nodiscard]] std::optional<ReplyEntry> find(u64 hash, const Move& human) const;
+
+    // 書き手のみ。
+    void append(u64 hash, const Move& human, const ReplyEntry& entry);
+
+    // 書き手のみ。追記した内容をディスクに書き出す (これ以前の追記は電源断でも残る)。
+    void sync();
+
+    // 有効なキーの数
+    [[nodiscard]] std::size_t size() const { return index_.size(); }
+
+    [[nodiscard]] bool writable() const { return mode_ == Mode::Write; }
+};
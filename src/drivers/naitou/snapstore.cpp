@@ -0,0 +1,270 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "core.hpp"
+#include "prelude.hpp"
+#include "snapstore.hpp"
+
+namespace {
+
+// チャンクのハッシュ。暗号学的な強さは要らない (一致判定は最後にバイト比較する)。
+u64 hash_chunk(const u8* data, const std::size_t size) {
+    constexpr u64 K = 0x9E3779B97F4A7C15;
+
+    u64 h = size * K;
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        u64 w;
+        std::memcpy(&w, data + i, 8);
+        h = (h ^ w) * K;
+        h ^= h >> 29;
+    }
+    for (; i < size; ++i)
+        h = (h ^ data[i]) * K;
+
+    return h ^ (h >> 32);
+}
+
+} // anonymous namespace
+
+SnapshotStore::SnapshotStore(const std::size_t budget, std::string path_spill, const std::size_t chunk_size)
+    : chunk_size_(chunk_size)
+    , budget_(budget)
+    , path_spill_(std::move(path_spill)) {
+    if (chunk_size_ == 0) PANIC("SnapshotStore::SnapshotStore(): chunk_size must be positive");
+}
+
+SnapshotStore::~SnapshotStore() {
+    if (spill_) {
+        std::fclose(spill_);
+        std::remove(path_spill_.c_str());
+    }
+}
+
+SnapshotHandle SnapshotStore::put(const Snapshot& snapshot) {
+    u32 index;
+    if (free_entries_.empty()) {
+        index = entries_.size();
+        entries_.emplace_back();
+    }
+    else {
+        index = free_entries_.back();
+        free_entries_.pop_back();
+    }
+
+    entries_[index].live = true;
+    make_resident(index, snapshot.data(), snapshot.size());
+    lru_push_front(index);
+    ++stats_.snapshot_count;
+
+    enforce_budget(index);
+
+    return SnapshotHandle(index);
+}
+
+void SnapshotStore::get(const SnapshotHandle handle, Snapshot& snapshot) {
+    auto& e = entry(handle);
+
+    if (e.spill_offset >= 0) {
+        unspill(handle.index_);
+    }
+    else {
+        lru_unlink(handle.index_);
+        lru_push_front(handle.index_);
+    }
+
+    buf_.resize(e.size);
+    std::size_t pos = 0;
+    for (const auto id : e.chunks) {
+        const auto& bytes = chunks_[id].bytes;
+        std::memcpy(buf_.data() + pos, bytes.data(), bytes.size());
+        pos += bytes.size();
+    }
+
+    snapshot.assign(buf_.data(), buf_.size());
+}
+
+void SnapshotStore::release(const SnapshotHandle handle) {
+    auto& e = entry(handle);
+
+    // 退避ファイル上の領域は捨てるだけ
+    if (e.spill_offset < 0) {
+        drop_resident(handle.index_);
+        lru_unlink(handle.index_);
+    }
+
+    e = Entry {};
+    free_entries_.push_back(handle.index_);
+    --stats_.snapshot_count;
+}
+
+SnapshotStore::Entry& SnapshotStore::entry(const SnapshotHandle handle) {
+    if (!handle.is_valid() || handle.index_ >= entries_.size() || !entries_[handle.index_].live)
+        PANIC("SnapshotStore: invalid handle");
+    return entries_[handle.index_];
+}
+
+u32 SnapshotStore::intern_chunk(const u8* data, const std::size_t size) {
+    const auto hash = hash_chunk(data, size);
+    ++stats_.chunk_lookups;
+
+    const auto [first, last] = chunk_index_.equal_range(hash);
+    for (auto it = first; it != last; ++it) {
+        auto& chunk = chunks_[it->second];
+        if (chunk.bytes.size() == size && std::memcmp(chunk.bytes.data(), data, size) == 0) {
+            ++chunk.refcount;
+            ++stats_.chunk_hits;
+            return it->second;
+        }
+    }
+
+    u32 id;
+    if (free_chunks_.empty()) {
+        id = chunks_.size();
+        chunks_.emplace_back();
+    }
+    else {
+        id = free_chunks_.back();
+        free_chunks_.pop_back();
+    }
+
+    auto& chunk = chunks_[id];
+    chunk.hash = hash;
+    chunk.refcount = 1;
+    chunk.bytes.assign(data, data + size);
+    chunk_index_.emplace(hash, id);
+
+    ++stats_.chunk_count;
+    stats_.resident_bytes += size;
+
+    return id;
+}
+
+void SnapshotStore::release_chunk(const u32 id) {
+    auto& chunk = chunks_[id];
+    if (--chunk.refcount > 0) return;
+
+    const auto [first, last] = chunk_index_.equal_range(chunk.hash);
+    for (auto it = first; it != last; ++it) {
+        if (it->second == id) {
+            chunk_index_.erase(it);
+            break;
+        }
+    }
+
+    --stats_.chunk_count;
+    stats_.resident_bytes -= chunk.bytes.size();
+
+    chunk.bytes.clear();
+    chunk.bytes.shrink_to_fit();
+    free_chunks_.push_back(id);
+}
+
+void SnapshotStore::make_resident(const u32 index, const u8* data, const std::size_t size) {
+    auto& e = entries_[index];
+
+    e.chunks.clear();
+    e.chunks.reserve((size + chunk_size_ - 1) / chunk_size_);
+    for (std::size_t pos = 0; pos < size; pos += chunk_size_)
+        e.chunks.push_back(intern_chunk(data + pos, std::min(chunk_size_, size - pos)));
+    e.size = size;
+    e.spill_offset = -1;
+
+    ++stats_.resident_count;
+    stats_.resident_bytes += e.chunks.size() * sizeof(u32);
+    stats_.logical_bytes += size;
+}
+
+void SnapshotStore::drop_resident(const u32 index) {
+    auto& e = entries_[index];
+
+    for (const auto id : e.chunks)
+        release_chunk(id);
+
+    --stats_.resident_count;
+    stats_.resident_bytes -= e.chunks.size() * sizeof(u32);
+    stats_.logical_bytes -= e.size;
+
+    e.chunks.clear();
+    e.chunks.shrink_to_fit();
+}
+
+void SnapshotStore::lru_unlink(const u32 index) {
+    auto& e = entries_[index];
+
+    if (e.lru_prev != NIL)
+        entries_[e.lru_prev].lru_next = e.lru_next;
+    else
+        lru_head_ = e.lru_next;
+
+    if (e.lru_next != NIL)
+        entries_[e.lru_next].lru_prev = e.lru_prev;
+    else
+        lru_tail_ = e.lru_prev;
+
+    e.lru_prev = e.lru_next = NIL;
+}
+
+void SnapshotStore::lru_push_front(const u32 index) {
+    auto& e = entries_[index];
+
+    e.lru_prev = NIL;
+    e.lru_next = lru_head_;
+    if (lru_head_ != NIL)
+        entries_[lru_head_].lru_prev = index;
+    else
+        lru_tail_ = index;
+    lru_head_ = index;
+}
+
+void SnapshotStore::spill(const u32 index) {
+    if (!spill_) {
+        spill_ = std::fopen(path_spill_.c_str(), "w+b");
+        if (!spill_) PANIC("SnapshotStore: cannot open spill file: {}", path_spill_);
+    }
+
+    auto& e = entries_[index];
+
+    buf_.resize(e.size);
+    std::size_t pos = 0;
+    for (const auto id : e.chunks) {
+        const auto& bytes = chunks_[id].bytes;
+        std::memcpy(buf_.data() + pos, bytes.data(), bytes.size());
+        pos += bytes.size();
+    }
+
+    if (std::fseek(spill_, spill_end_, SEEK_SET) != 0 || std::fwrite(buf_.data(), 1, buf_.size(), spill_) != buf_.size())
+        PANIC("SnapshotStore: cannot write spill file: {}", path_spill_);
+
+    drop_resident(index);
+    lru_unlink(index);
+    e.spill_offset = spill_end_;
+    spill_end_ += e.size;
+
+    ++stats_.spill_writes;
+}
+
+void SnapshotStore::unspill(const u32 index) {
+    auto& e = entries_[index];
+
+    buf_.resize(e.size);
+    if (std::fseek(spill_, e.spill_offset, SEEK_SET) != 0 || std::fread(buf_.data(), 1, buf_.size(), spill_) != buf_.size())
+        PANIC("SnapshotStore: cannot read spill file: {}", path_spill_);
+
+    make_resident(index, buf_.data(), buf_.size());
+    lru_push_front(index);
+
+    ++stats_.spill_reads;
+
+    enforce_budget(index);
+}
+
+void SnapshotStore::enforce_budget(const u32 keep) {
+    // チャンクが共有されていると追い出しても減らないことがあるが、いずれ keep 以外は全て追い出される
+    while (stats_.resident_bytes > budget_ && lru_tail_ != NIL && lru_tail_ != keep)
+        spill(lru_tail_);
+}
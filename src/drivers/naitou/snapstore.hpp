@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/core/noncopyable.hpp>
+
+#include "core.hpp"
+#include "prelude.hpp"
+
+// SnapshotStore に預けたスナップショットの引換券
+class SnapshotHandle {
+private:
+    u32 index_ { UINT32_MAX };
+
+    explicit SnapshotHandle(u32 index)
+        : index_(index) {}
+
+    friend class SnapshotStore;
+
+public:
+    SnapshotHandle() = default;
+
+    [[nodiscard]] bool is_valid() const { return index_ != UINT32_MAX; }
+
+    // 置換表などに詰めて持つための生の値。from_raw() で戻せる (ストアが解放済みの引換券は get() で弾かれる)
+    [[nodiscard]] u32 raw() const { return index_; }
+    [[nodiscard]] static SnapshotHandle from_raw(u32 raw) { return SnapshotHandle(raw); }
+};
+
+struct SnapshotStoreStats {
+    std::size_t snapshot_count { 0 }; // 預かっているスナップショット数
+    std::size_t resident_count { 0 }; // そのうちメモリ上にあるもの
+    std::size_t chunk_count { 0 }; // 実体を持つチャンク数
+    std::size_t resident_bytes { 0 }; // チャンク本体 + チャンク ID 列のバイト数
+    std::size_t logical_bytes { 0 }; // メモリ上のスナップショットを素朴に持った場合のバイト数
+    u64 chunk_lookups { 0 }; // put() で intern したチャンク数
+    u64 chunk_hits { 0 }; // そのうち既存チャンクと一致したもの
+    u64 spill_writes { 0 }; // 退避ファイルへ追い出した回数
+    u64 spill_reads { 0 }; // 退避ファイルから読み戻した回数
+
+    [[nodiscard]] double hit_rate() const { return chunk_lookups == 0 ? 0.0 : double(chunk_hits) / chunk_lookups; }
+
+    // logical_bytes / resident_bytes
+    [[nodiscard]] double dedup_ratio() const { return resident_bytes == 0 ? 0.0 : double(logical_bytes) / resident_bytes; }
+};
+
+// スナップショットを固定長チャンクに分け、チャンクをハッシュで intern して保持する。
+// 探索木のノードの状態は数バイトしか違わないことが多いので、大半のチャンクは共有される。
+//
+// メモリ上の使用量が budget を超えたら、最も長く使われていないスナップショットを
+// 退避ファイルへ追い出す。追い出されたものも get() で透過的に読み戻される。
+// 退避ファイルは追記のみで、領域は再利用しない (ストアを破棄すると消える)。
+//
+// スレッドセーフではない。
+class SnapshotStore : private boost::noncopyable {
+private:
+    static constexpr u32 NIL = UINT32_MAX;
+
+    struct Chunk {
+        u64 hash;
+        u32 refcount; // 0 なら空き
+        std::vector<u8> bytes;
+    };
+
+    struct Entry {
+        bool live { false };
+        std::vector<u32> chunks {}; // メモリ上にあるとき
+        std::size_t size { 0 }; // 状態のバイト数
+        long spill_offset { -1 }; // 退避中なら退避ファイル内の位置
+        u32 lru_prev { NIL };
+        u32 lru_next { NIL };
+    };
+
+    std::size_t chunk_size_;
+    std::size_t budget_;
+    std::string path_spill_;
+    std::FILE* spill_ { nullptr };
+    long spill_end_ { 0 };
+
+    std::vector<Chunk> chunks_ {};
+    std::vector<u32> free_chunks_ {};
+    std::unordered_multimap<u64, u32> chunk_index_ {}; // hash -> chunk
+
+    std::vector<Entry> entries_ {};
+    std::vector<u32> free_entries_ {};
+    u32 lru_head_ { NIL }; // 最近使ったもの
+    u32 lru_tail_ { NIL };
+
+    SnapshotStoreStats stats_ {};
+
+    std::vector<u8> buf_ {}; // 作業用
+
+    Entry& entry(SnapshotHandle handle);
+
+    u32 intern_chunk(const u8* data, std::size_t size);
+    void release_chunk(u32 id);
+
+    void make_resident(u32 index, const u8* data, std::size_t size);
+    void drop_resident(u32 index);
+
+    void lru_unlink(u32 index);
+    void lru_push_front(u32 index);
+
+    void spill(u32 index);
+    void unspill(u32 index);
+    void enforce_budget(u32 keep);
+
+public:
+    // budget: メモリ上に置くバイト数の上限
+    // path_spill: 退避ファイルのパス
+    // chunk_size: チャンク長 (バイト)
+    SnapshotStore(std::size_t budget, std::string path_spill, std::size_t chunk_size = 256);
+    ~SnapshotStore();
+
+    // スナップショットを預ける。
+    [[nodiscard]] SnapshotHandle put(const Snapshot& snapshot);
+
+    // 預けたスナップショットを snapshot に復元する。
+    void get(SnapshotHandle handle, Snapshot& snapshot);
+
+    // 預けたスナップショットを捨てる。以後 handle は無効。
+    void release(SnapshotHandle handle);
+
+    [[nodiscard]] const SnapshotStoreStats& stats() const { return stats_; }
+};
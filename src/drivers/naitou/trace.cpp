@@ -0,0 +1,272 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "core.hpp"
+#include "naitou.hpp"
+#include "prelude.hpp"
+#include "trace.hpp"
+
+namespace {
+
+constexpr std::array<char, 4> TRACE_MAGIC = { 'N', 'C', 'T', 'R' };
+
+// レコードの頭 (観測点の番号, 思考開始からのフレーム数)
+constexpr std::size_t RECORD_HEADER_SIZE = 4;
+
+u16 parse_hex(const std::string& s, const int lineno) {
+    const auto digits = s.rfind("0x", 0) == 0 || s.rfind("0X", 0) == 0 ? s.substr(2) : s;
+    if (digits.empty() || digits.size() > 4 || !std::all_of(digits.begin(), digits.end(), [](const char c) { return std::isxdigit(static_cast<unsigned char>(c)); }))
+        PANIC("ProbeSet: line {}: invalid hex number: {}", lineno, s);
+    return u16(std::stoul(digits, nullptr, 16));
+}
+
+ProbeSet::Field parse_field(const std::string& s, const int lineno) {
+    const auto eq = s.find('=');
+    const auto colon = s.find(':', eq);
+    if (eq == std::string::npos || eq == 0 || colon == std::string::npos) PANIC("ProbeSet: line {}: expected <name>=<addr>:<len>[s]: {}", lineno, s);
+
+    ProbeSet::Field field;
+    field.name = s.substr(0, eq);
+    field.addr = parse_hex(s.substr(eq + 1, colon - eq - 1), lineno);
+    auto len = s.substr(colon + 1);
+    field.is_signed = !len.empty() && len.back() == 's';
+    if (field.is_signed) len.pop_back();
+    field.len = parse_hex(len, lineno);
+    if (field.len == 0 || u32(field.addr) + field.len > 0x10000) PANIC("ProbeSet: line {}: invalid field range: {}", lineno, s);
+
+    return field;
+}
+
+// 整数として表に出せる長さか
+bool is_scalar(const u16 len) {
+    return len == 1 || len == 2 || len == 4;
+}
+
+std::string format_field(const ProbeSet::Field& field, const u8* p) {
+    if (!is_scalar(field.len)) {
+        std::string res;
+        for (const auto i : IRANGE(field.len))
+            res += FORMAT("{:02X}", p[i]);
+        return res;
+    }
+
+    u32 value = 0;
+    for (int i = field.len - 1; i >= 0; --i)
+        value = (value << 8) | p[i];
+    if (!field.is_signed) return std::to_string(value);
+
+    const auto bits = 8 * field.len;
+    const auto sign = u32(1) << (bits - 1);
+    const auto sext = bits == 32 ? i64(i32(value)) : i64(value ^ sign) - i64(sign);
+    return std::to_string(sext);
+}
+
+template <class T>
+void put(std::ostream& out, const T& x) {
+    out.write(reinterpret_cast<const char*>(&x), sizeof(T));
+}
+
+template <class T>
+bool get(std::istream& in, T& x) {
+    return bool(in.read(reinterpret_cast<char*>(&x), sizeof(T)));
+}
+
+// フックを掛ける前に (メンバ初期化の中で) 確かめる
+std::size_t checked_capacity(const ProbeSet& probes, const std::size_t capacity) {
+    if (capacity == 0) PANIC("ComTracer::ComTracer(): capacity must be positive");
+    for (const auto& probe : probes.probes()) {
+        if (RECORD_HEADER_SIZE + probe.payload_size > capacity) PANIC("ComTracer::ComTracer(): capacity too small for probe: {}", probe.name);
+    }
+    return capacity;
+}
+
+} // anonymous namespace
+
+//--------------------------------------------------------------------
+// ProbeSet
+//--------------------------------------------------------------------
+
+ProbeSet ProbeSet::parse(std::istream& in) {
+    ProbeSet set;
+
+    std::string line;
+    for (int lineno = 1; std::getline(in, line); ++lineno) {
+        if (const auto pos = line.find('#'); pos != std::string::npos) line.erase(pos);
+
+        std::istringstream words(line);
+        std::string kind;
+        if (!(words >> kind)) continue;
+        if (kind != "probe") PANIC("ProbeSet: line {}: unknown directive: {}", lineno, kind);
+
+        Probe probe;
+        std::string pc;
+        if (!(words >> probe.name >> pc)) PANIC("ProbeSet: line {}: expected probe <name> <pc> ...", lineno);
+        probe.pc = parse_hex(pc, lineno);
+        probe.payload_size = 0;
+        for (std::string word; words >> word;) {
+            probe.fields.push_back(parse_field(word, lineno));
+            probe.payload_size += probe.fields.back().len;
+        }
+
+        set.probes_.push_back(std::move(probe));
+        if (set.probes_.size() > 0x10000) PANIC("ProbeSet: too many probes");
+    }
+
+    return set;
+}
+
+ProbeSet ProbeSet::load(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) PANIC("ProbeSet::load(): cannot open: {}", path);
+    return parse(in);
+}
+
+//--------------------------------------------------------------------
+// ComTracer
+//--------------------------------------------------------------------
+
+ComTracer::ComTracer(Core& core, ProbeSet probes, const std::size_t capacity, std::function<void(const ComTrace&)> sink)
+    : core_(core)
+    , probes_(std::move(probes))
+    , sink_(std::move(sink))
+    , ring_(checked_capacity(probes_, capacity))
+    , hook_side_(core.hook_on_write(ADDR_SIDE, 1, [this](u16, u8 value, u16) { on_write_side(value); })) {
+    for (const auto i : IRANGE(probes_.probes().size()))
+        hooks_exec_.push_back(core_.hook_before_exec(probes_.probes()[i].pc, [this, i]() { on_exec(i); }));
+}
+
+ComTracer::~ComTracer() {
+    for (const auto hook : hooks_exec_)
+        core_.unhook_before_exec(hook);
+    core_.unhook_on_write(hook_side_);
+}
+
+void ComTracer::ring_put(const u8* data, const std::size_t size) {
+    const auto ofs = head_ % ring_.size();
+    const auto n = std::min<u64>(size, ring_.size() - ofs);
+    std::memcpy(ring_.data() + ofs, data, n);
+    std::memcpy(ring_.data(), data + n, size - n);
+    head_ += size;
+}
+
+void ComTracer::ring_get(const u64 pos, u8* data, const std::size_t size) const {
+    const auto ofs = pos % ring_.size();
+    const auto n = std::min<u64>(size, ring_.size() - ofs);
+    std::memcpy(data, ring_.data() + ofs, n);
+    std::memcpy(data + n, ring_.data(), size - n);
+}
+
+void ComTracer::on_exec(const std::size_t i_probe) {
+    if (!active_) return;
+
+    const auto& probe = probes_.probes()[i_probe];
+    const auto need = RECORD_HEADER_SIZE + probe.payload_size;
+
+    // 溢れる分は古いレコードから捨てる
+    while (ring_.size() - (head_ - tail_) < need) {
+        u16 i_old;
+        ring_get(tail_, reinterpret_cast<u8*>(&i_old), sizeof(i_old));
+        tail_ += RECORD_HEADER_SIZE + probes_.probes()[i_old].payload_size;
+        ++cur_.n_dropped;
+    }
+
+    const u16 header[2] = { u16(i_probe), u16(std::min<u32>(core_.frame_count() - cur_.frame_start, 0xFFFF)) };
+    ring_put(reinterpret_cast<const u8*>(header), sizeof(header));
+
+    const auto ram = core_.ram();
+    for (const auto& field : probe.fields) {
+        if (field.addr + field.len <= ram.size()) {
+            ring_put(ram.data() + field.addr, field.len);
+            continue;
+        }
+        std::array<u8, 256> buf;
+        for (u32 ofs = 0; ofs < field.len; ofs += buf.size()) {
+            const auto n = std::min<std::size_t>(buf.size(), field.len - ofs);
+            core_.read_bytes(u16(field.addr + ofs), n, buf.data());
+            ring_put(buf.data(), n);
+        }
+    }
+}
+
+void ComTracer::on_write_side(const u8 value) {
+    const bool com = value == 0;
+    if (com == active_) return;
+
+    if (com) {
+        head_ = tail_ = 0;
+        cur_.frame_start = u32(core_.frame_count());
+        cur_.n_dropped = 0;
+        active_ = true;
+        return;
+    }
+
+    active_ = false;
+    cur_.records.resize(head_ - tail_);
+    ring_get(tail_, cur_.records.data(), cur_.records.size());
+    sink_(cur_);
+    ++cur_.move_index;
+}
+
+//--------------------------------------------------------------------
+// 直列化
+//--------------------------------------------------------------------
+
+void write_trace(std::ostream& out, const ComTrace& trace) {
+    out.write(TRACE_MAGIC.data(), TRACE_MAGIC.size());
+    put(out, trace.move_index);
+    put(out, trace.frame_start);
+    put(out, trace.n_dropped);
+    put(out, u32(trace.records.size()));
+    out.write(reinterpret_cast<const char*>(trace.records.data()), trace.records.size());
+}
+
+bool read_trace(std::istream& in, ComTrace& trace) {
+    std::array<char, 4> magic;
+    if (!in.read(magic.data(), magic.size())) return false;
+    if (magic != TRACE_MAGIC) PANIC("read_trace(): bad magic");
+
+    u32 size;
+    if (!get(in, trace.move_index) || !get(in, trace.frame_start) || !get(in, trace.n_dropped) || !get(in, size)) PANIC("read_trace(): truncated header");
+    trace.records.resize(size);
+    if (!in.read(reinterpret_cast<char*>(trace.records.data()), size)) PANIC("read_trace(): truncated records");
+
+    return true;
+}
+
+void decode_trace(const ProbeSet& probes, std::istream& in, std::ostream& out) {
+    out << "move\tframe\tprobe\tfields\n";
+
+    ComTrace trace;
+    while (read_trace(in, trace)) {
+        if (trace.n_dropped > 0) out << FORMAT("{}\t-\t(dropped)\t{}\n", trace.move_index, trace.n_dropped);
+
+        const auto& recs = trace.records;
+        for (std::size_t pos = 0; pos < recs.size();) {
+            if (pos + RECORD_HEADER_SIZE > recs.size()) PANIC("decode_trace(): truncated record");
+            u16 header[2];
+            std::memcpy(header, recs.data() + pos, sizeof(header));
+            pos += RECORD_HEADER_SIZE;
+
+            if (header[0] >= probes.probes().size()) PANIC("decode_trace(): unknown probe: {} (wrong config?)", header[0]);
+            const auto& probe = probes.probes()[header[0]];
+            if (pos + probe.payload_size > recs.size()) PANIC("decode_trace(): truncated record");
+
+            out << FORMAT("{}\t{}\t{}", trace.move_index, header[1], probe.name);
+            for (const auto& field : probe.fields) {
+                out << FORMAT("\t{}={}", field.name, format_field(field, recs.data() + pos));
+                pos += field.len;
+            }
+            out << '\n';
+        }
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include <boost/core/noncopyable.hpp>
+
+#include "core.hpp"
+#include "prelude.hpp"
+
+// COM の思考中に取る RAM の観測点の集合 (設定ファイルから読む)。
+//
+// 設定ファイルは 1 行に 1 つの観測点で、'#' 以降はコメント:
+//   probe <名前> <PC> [<フィールド名>=<アドレス>:<バイト数>[s] ...]
+// 数値は 16 進 ("0x" は省略可)。PC の命令を実行する直前に各フィールドを読む。
+// バイト数が 1, 2, 4 ならリトルエンディアンの整数として表に出し ('s' を付ければ符号付き)、それ以外は 16 進の列。
+// 例 (アドレスは ROM を解析して決めること):
+//   probe candidate C5A0 src=0x20:1 dst=0x21:1 score=0x22:2s
+//   probe prune C61E depth=0x30:1
+class ProbeSet {
+public:
+    struct Field {
+        std::string name;
+        u16 addr;
+        u16 len;
+        bool is_signed;
+    };
+
+    struct Probe {
+        std::string name;
+        u16 pc;
+        std::vector<Field> fields;
+        std::size_t payload_size; // fields の len の合計
+    };
+
+private:
+    std::vector<Probe> probes_ {};
+
+public:
+    // 書式が不正なら PANIC (行番号つき)。
+    [[nodiscard]] static ProbeSet parse(std::istream& in);
+    [[nodiscard]] static ProbeSet load(const std::string& path);
+
+    [[nodiscard]] const std::vector<Probe>& probes() const { return probes_; }
+};
+
+// COM の 1 手分の思考で集めたレコード。
+// records は (u16 観測点の番号, u16 思考開始からのフレーム数, ペイロード) の並びで、ペイロードの長さは観測点で決まる。
+struct ComTrace {
+    u32 move_index; // ComTracer を作ってから何手目の COM の手か (0 始まり)
+    u32 frame_start; // 思考を始めたフレーム (Core::frame_count())
+    u32 n_dropped; // バッファが溢れて捨てた (古い方から) レコード数
+    std::vector<u8> records;
+};
+
+// ProbeSet の各観測点に Core::hook_before_exec() を掛け、COM の手番の間だけレコードをリングバッファに書く。
+// 手番 (ADDR_SIDE) が COM になったら空にして記録を始め、HUM に戻ったら sink に渡す。
+// printf や 1 命令ずつのステップ実行と違い、フック 1 回あたりの仕事は数バイトのコピーだけなので、思考はほとんど遅くならない。
+//
+// フックは core に対して掛けるので、スナップショットのロードで手番が切り替わっても区切りは付かない
+// (その手は次に手番が変わったときに渡される)。
+class ComTracer : private boost::noncopyable {
+private:
+    Core& core_;
+    ProbeSet probes_;
+    std::function<void(const ComTrace&)> sink_;
+
+    std::vector<u8> ring_;
+    u64 head_ { 0 }; // 書き込み位置 (単調増加, 実際の位置は ring_.size() で割った余り)
+    u64 tail_ { 0 }; // 最も古いレコードの位置
+
+    bool active_ { false }; // 思考中に作られたら、その手は記録せず次の手から
+    ComTrace cur_ {};
+
+    std::vector<HookHandle> hooks_exec_ {};
+    HookHandle hook_side_;
+
+    void on_exec(std::size_t i_probe);
+    void on_write_side(u8 value);
+
+    void ring_put(const u8* data, std::size_t size);
+    void ring_get(u64 pos, u8* data, std::size_t size) const;
+
+public:
+    // capacity: リングバッファのバイト数 (正で、最大のレコードが入る大きさが必要。足りなければフックを掛ける前に PANIC)
+    ComTracer(Core& core, ProbeSet probes, std::size_t capacity, std::function<void(const ComTrace&)> sink);
+    ~ComTracer();
+};
+
+// ComTrace をストリームへ書く/から読む (ファイルに溜めて後で decode_trace() するため)。
+void write_trace(std::ostream& out, const ComTrace& trace);
+[[nodiscard]] bool read_trace(std::istream& in, ComTrace& trace);
+
+// write_trace() で書いた列を、1 レコード 1 行のタブ区切りの表にする:
+//   move  frame  probe  <フィールド名>=<値> ...
+// probes は記録したときと同じものでなければならない。
+void decode_trace(const ProbeSet& probes, std::istream& in, std::ostream& out);
@@ -0,0 +1,59 @@
+#include <atomic>
+#include <cstddef>
+#include <optional>
+
+#include <sys/mman.h>
+
+#include "prelude.hpp"
+#include "snapstore.hpp"
+#include "ttable.hpp"
+
+TranspositionTable::TranspositionTable(const int size_log2) {
+    if (size_log2 < 0 || size_log2 > 40) PANIC("TranspositionTable::TranspositionTable(): invalid size_log2: {}", size_log2);
+
+    size_ = std::size_t(1) << size_log2;
+    mask_ = size_ - 1;
+
+    // 匿名の共有マッピングは 0 で初期化される (全エントリが空き)
+    void* p = mmap(nullptr, sizeof(Entry) * size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) PANIC("TranspositionTable::TranspositionTable(): mmap() failed");
+    entries_ = static_cast<Entry*>(p);
+}
+
+TranspositionTable::~TranspositionTable() {
+    munmap(entries_, sizeof(Entry) * size_);
+}
+
+u64 TranspositionTable::pack(const TtValue& value) {
+    return (u64(value.snapshot.raw()) << 32) | value.result;
+}
+
+TtValue TranspositionTable::unpack(const u64 data) {
+    return TtValue { SnapshotHandle::from_raw(u32(data >> 32)), u32(data) };
+}
+
+std::optional<TtValue> TranspositionTable::probe(const u64 key) const {
+    const auto& e = entries_[key & mask_];
+    const auto check = e.check.load(std::memory_order_relaxed);
+    const auto data = e.data.load(std::memory_order_relaxed);
+
+    if (check == 0 && data == 0) return std::nullopt;
+    if ((check ^ data) != key) return std::nullopt;
+    return unpack(data);
+}
+
+void TranspositionTable::store(const u64 key, const TtValue& value) {
+    if (key == 0) PANIC("TranspositionTable::store(): key must be nonzero");
+
+    auto& e = entries_[key & mask_];
+    const auto data = pack(value);
+    e.check.store(key ^ data, std::memory_order_relaxed);
+    e.data.store(data, std::memory_order_relaxed);
+}
+
+void TranspositionTable::clear() {
+    for (const auto i : IRANGE(size_)) {
+        entries_[i].check.store(0, std::memory_order_relaxed);
+        entries_[i].data.store(0, std::memory_order_relaxed);
+    }
+}
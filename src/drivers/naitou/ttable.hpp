@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <optional>
+
+#include <boost/core/noncopyable.hpp>
+
+#include "prelude.hpp"
+#include "snapstore.hpp"
+
+// 置換表に登録する値
+struct TtValue {
+    SnapshotHandle snapshot {}; // その局面のスナップショット
+    u32 result { 0 }; // 利用者が定義する計算済みの結果 (評価値, 探索済みフラグなど)
+};
+
+// 局面の Zobrist ハッシュ (Position::hash()) をキーとする固定長の置換表。
+// 異なる手順で同じ局面に達したとき、スナップショットのロードと COM の思考をやり直さずに済ませるためのもの。
+//
+// ロックフリー: 各エントリは (key ^ data, data) の 2 語で、書き込みが競合して片方だけ
+// 書き換わったエントリはキーの検査で弾かれる (Hyatt の lockless hashing)。
+// 表は共有メモリに置くので、複数スレッドに加えて fork した子プロセスとも共有される。
+//
+// 置き換えは常に上書き。キー 0 は空きエントリと区別できないので登録できない
+// (玉のある局面のハッシュが 0 になることは事実上ない)。
+class TranspositionTable : private boost::noncopyable {
+private:
+    struct Entry {
+        std::atomic<u64> check; // key ^ data
+        std::atomic<u64> data;
+    };
+
+    static_assert(std::atomic<u64>::is_always_lock_free);
+
+    Entry* entries_ { nullptr };
+    std::size_t size_ { 0 };
+    u64 mask_ { 0 };
+
+    [[nodiscard]] static u64 pack(const TtValue& value);
+    [[nodiscard]] static TtValue unpack(u64 data);
+
+public:
+    // エントリ数は 2^size_log2
+    explicit TranspositionTable(int size_log2);
+    ~TranspositionTable();
+
+    [[nodiscard]] std::size_t size() const { return size_; }
+
+    [[nodiscard]] std::optional<TtValue> probe(u64 key) const;
+
+    void store(u64 key, const TtValue& value);
+
+    void clear();
+};
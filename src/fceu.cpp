@@ -354,6 +354,7 @@ void SetWriteHandler(int32 start, int32 end, writefunc func) {
 }
 
 uint8 *RAM;
+uint32 RAMDirty = 0;
 
 //---------
 //windows might need to allocate these differently, so we have some special code
@@ -372,10 +373,12 @@ uint8 PAL = 0;
 
 static DECLFW(BRAML) {
 	RAM[A] = V;
+	FCEU_MARK_RAM_DIRTY(A);
 }
 
 static DECLFW(BRAMH) {
 	RAM[A & 0x7FF] = V;
+	FCEU_MARK_RAM_DIRTY(A);
 }
 
 static DECLFR(ARAML) {
@@ -386,6 +389,28 @@ static DECLFR(ARAMH) {
 	return RAM[A & 0x7FF];
 }
 
+uint8 *FCEU_GetPlainMemPtr(uint16 A, uint32 size) {
+	readfunc func;
+	uint8 *p;
+	uint32 x;
+
+	if (size == 0 || (A >> 11) != ((A + size - 1) >> 11)) return NULL;
+
+	//anything else is registers, or handlers that only look like memory (cheats, game genie, mapper logic)
+	func = ARead[A];
+	if (func == ARAML || func == ARAMH)
+		p = RAM + (A & 0x7FF);
+	else if (A >= 0x5000 && (func == CartBR || func == CartBROB) && Page[A >> 11])
+		p = Page[A >> 11] + A;
+	else
+		return NULL;
+
+	for (x = 1; x < size; x++)
+		if (ARead[A + x] != func) return NULL;
+
+	return p;
+}
+
 
 void ResetGameLoaded(void) {
 	if (GameInfo) FCEU_CloseGame();
@@ -667,6 +692,10 @@ void FCEUI_Emulate(uint8 **pXBuf, int32 **SoundBuf, int32 *SoundBufSize, int ski
 	//skip initiates frame skip if 1, or frame skip and sound skip if 2
 	int r, ssize;
 
+	//a frame left mid-way by X6502_Stop() continues where it stopped; the frame setup already ran
+	if (FCEUPPU_InFrame())
+		goto resume_frame;
+
 	JustFrameAdvanced = false;
 
 	if (frameAdvanceRequested)
@@ -727,7 +756,14 @@ void FCEUI_Emulate(uint8 **pXBuf, int32 **SoundBuf, int32 *SoundBufSize, int ski
 #endif
 
 	if (geniestage != 1) FCEU_ApplyPeriodicCheats();
+resume_frame:
 	r = FCEUPPU_Loop(skip);
+	if (r < 0) {
+		*pXBuf = 0;
+		*SoundBuf = 0;
+		*SoundBufSize = 0;
+		return;
+	}
 
 	if (skip != 2) ssize = FlushEmulateSound();  //If skip = 2 we are skipping sound processing
 
@@ -735,7 +771,9 @@ void FCEUI_Emulate(uint8 **pXBuf, int32 **SoundBuf, int32 *SoundBufSize, int ski
 	CallRegisteredLuaFunctions(LUACALL_AFTEREMULATION);
 #endif
 
-	FCEU_PutImage();
+	//no overlays on a frame that wasn't drawn
+	if (!FCEUI_GetHeadless())
+		FCEU_PutImage();
 
 #ifdef WIN32
 	//These Windows only dialogs need to be updated only once per frame so they are included here
@@ -928,6 +966,8 @@ void PowerNES(void) {
 	InitializeInput();
 	FCEUSND_Power();
 	FCEUPPU_Power();
+	//RAM and NTARAM were rewritten behind the dirty tracking
+	FCEUSS_InvalidateRawSync();
 
 	//Have the external game hardware "powered" after the internal NES stuff.  Needed for the NSF code and VS System code.
 	GameInterface(GI_POWER);
@@ -68,6 +68,9 @@ extern uint8 qtaintramreg;
 #define GAME_MEM_BLOCK_SIZE 131072
 
 extern  uint8  *RAM;            //shared memory modifications
+//RAM granules (64 bytes, one bit each) written since the last raw savestate sync. see FCEUSS_LoadRaw()
+extern  uint32 RAMDirty;
+#define FCEU_MARK_RAM_DIRTY(A) (RAMDirty |= 1u << (((A) & 0x7FF) >> 6))
 extern int EmulationPaused;
 extern int frameAdvance_Delay;
 
@@ -77,6 +80,11 @@ void FCEU_WriteRomByte(uint32 i, uint8 value);
 extern readfunc ARead[0x10000];
 extern writefunc BWrite[0x10000];
 
+//returns a pointer to the bytes at [A, A+size) when every one of them is read from plain memory
+//(internal RAM, or a PRG/WRAM page through CartBR) without side effects, else NULL.
+//the range must stay within one 2KB page. the pointer is invalidated by bank switches.
+uint8 *FCEU_GetPlainMemPtr(uint16 A, uint32 size);
+
 enum GI {
 	GI_RESETM2	=1,
 	GI_POWER =2,
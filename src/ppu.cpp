@@ -63,6 +63,7 @@
 static void FetchSpriteData(void);
 static void RefreshLine(int lastpixel);
 static void RefreshSprites(void);
+static void RefreshSprite0(void);
 static void CopySprites(uint8 *target);
 
 static void Fixit1(void);
@@ -374,6 +375,7 @@ static uint32 scanlines_per_frame;
 uint8 PPU[4];
 uint8 PPUSPL;
 uint8 NTARAM[0x800], PALRAM[0x20], SPRAM[0x100], SPRBUF[0x100];
+uint32 NTARAMDirty = 0;
 uint8 UPALRAM[0x03];//for 0x4/0x8/0xC addresses in palette, the ones in
 					//0x20 are 0 to not break fceu rendering.
 
@@ -435,8 +437,10 @@ inline void FFCEUX_PPUWrite_Default(uint32 A, uint8 V) {
 		if (QTAIHack && (qtaintramreg & 1)) {
 			QTAINTRAM[((((tmp & 0xF00) >> 10) >> ((qtaintramreg >> 1)) & 1) << 10) | (tmp & 0x3FF)] = V;
 		} else {
-			if (PPUNTARAM & (1 << ((tmp & 0xF00) >> 10)))
+			if (PPUNTARAM & (1 << ((tmp & 0xF00) >> 10))) {
 				vnapage[((tmp & 0xF00) >> 10)][tmp & 0x3FF] = V;
+				FCEUPPU_MarkNTDirty(&vnapage[((tmp & 0xF00) >> 10)][tmp & 0x3FF]);
+			}
 		}
 	} else {
 		if (!(tmp & 3)) {
@@ -968,8 +972,10 @@ static DECLFW(B2007) {
 			if (QTAIHack && (qtaintramreg & 1)) {
 				QTAINTRAM[((((tmp & 0xF00) >> 10) >> ((qtaintramreg >> 1)) & 1) << 10) | (tmp & 0x3FF)] = V;
 			} else {
-				if (PPUNTARAM & (1 << ((tmp & 0xF00) >> 10)))
+				if (PPUNTARAM & (1 << ((tmp & 0xF00) >> 10))) {
 					vnapage[((tmp & 0xF00) >> 10)][tmp & 0x3FF] = V;
+					FCEUPPU_MarkNTDirty(&vnapage[((tmp & 0xF00) >> 10)][tmp & 0x3FF]);
+				}
 			}
 		} else {
 			if (!(tmp & 3)) {
@@ -1007,8 +1013,24 @@ static int firsttile;
 int linestartts;	//no longer static so the debugger can see it
 static int tofix = 0;
 
+//headless mode: no pixels are produced (old PPU only).
+//a line is still rendered while a pending sprite 0 hit needs its background pixels, and never skipped
+//when a mapper watches the fetches (PPU_hook, MMC5) or the fetch path is special (PEC586, QTAI).
+//sprite 0 hit, sprite overflow, RefreshAddr and the scanline IRQ hooks behave exactly as when rendering.
+//input devices which read pixels (zapper) see nothing, and XBuf is left stale.
+static bool headless = false;
+
+void FCEUI_SetHeadless(bool on) {
+	headless = on;
+}
+
+bool FCEUI_GetHeadless() {
+	return headless;
+}
+
 static void ResetRL(uint8 *target) {
-	memset(target, 0xFF, 256);
+	if (!headless)
+		memset(target, 0xFF, 256);
 	InputScanlineHook(0, 0, 0, 0);
 	Plinef = target;
 	Pline = target;
@@ -1078,6 +1100,31 @@ static void CheckSpriteHit(int p) {
 //Needed for zapper emulation and *gasp* sprite emulation.
 static int spork = 0;
 
+#define TOFIXNUM (272 - 0x4)
+
+//RefreshLine() for a line nobody looks at: keeps the same RefreshAddr, Pline and Fixit1() bookkeeping, draws nothing.
+static void SkipLine(int lastpixel, int lasttile) {
+	if (ScreenON || SpriteON) {
+		//the address walk of pputile.inc
+		for (int x = firsttile; x < lasttile; x++) {
+			if ((RefreshAddr & 0x1f) == 0x1f)
+				RefreshAddr ^= 0x41F;
+			else
+				RefreshAddr++;
+		}
+		if (lasttile > 2)
+			Pline += (lasttile - (firsttile > 2 ? firsttile : 2)) * 8;
+	} else
+		Pline += (lasttile - firsttile) * 8;
+
+	if (lastpixel >= TOFIXNUM && tofix) {
+		Fixit1();
+		tofix = 0;
+	}
+
+	firsttile = lasttile;
+}
+
 // lasttile is really "second to last tile."
 static void RefreshLine(int lastpixel) {
 	static uint32 pshift[2];
@@ -1110,6 +1157,11 @@ static void RefreshLine(int lastpixel) {
 
 	P = Pline;
 
+	if (headless && sphitx == 0x100 && !MMC5Hack && !PPU_hook && !PEC586Hack && !QTAIHack) {
+		SkipLine(lastpixel, lasttile);
+		return;
+	}
+
 	vofs = 0;
 
 	if(PEC586Hack)
@@ -1299,60 +1351,101 @@ static void Fixit1(void) {
 }
 
 void MMC5_hb(int);		//Ugh ugh ugh.
+//the frame loop can be left mid-frame when a driver hook stops the CPU (X6502_Stop()), and is picked up again
+//by the next FCEUPPU_Loop(). the position is kept in ppu_phase/doline_phase: every X6502_Run() in FCEUPPU_Loop()
+//and DoLine() is followed by a numbered resume point (a case label of the switch around the function body).
+//nothing that lives across a resume point may be a local.
+static int ppu_phase = 0;
+static int doline_phase = 0;
+
+//the position is saved in states (FCEUPPU_STATEINFO) together with the rendering state that lives across lines,
+//so that a state saved at any instruction boundary resumes exactly. pointers into XBuf are kept as offsets (-1: none).
+//the partially drawn XBuf and the sound already mixed for the frame are not kept.
+static int32 PlineT = -1, PlinefT = -1;
+static int32 cpuHookDoneT = 0;
+
+#define PPU_RESUMABLE_RUN(phase_var, phase, cycles, ret) \
+	X6502_Run(cycles); \
+	case phase: \
+	if (X6502_Stopped()) { phase_var = phase; return ret; }
+#define LINE_RUN(phase, cycles) PPU_RESUMABLE_RUN(doline_phase, phase, cycles, )
+#define PPU_RUN(phase, cycles) PPU_RESUMABLE_RUN(ppu_phase, phase, cycles, -1)
+
+bool FCEUPPU_InFrame(void) {
+	return ppu_phase != 0;
+}
+
+void FCEUPPU_AbortFrame(void) {
+	ppu_phase = doline_phase = 0;
+	timestamp = soundtimestamp = 0;
+	Pline = Plinef = 0;
+	PlineT = PlinefT = -1;
+	cpuHookDoneT = 0;
+	X6502_ClearStop();
+}
+
 static void DoLine(void) {
+	const int phase = doline_phase;
+	doline_phase = 0;
+	switch (phase) {
+	case 0:
+
 	if (scanline >= 240 && scanline != totalscanlines) {
-		X6502_Run(256 + 69);
+		LINE_RUN(1, 256 + 69);
 		scanline++;
-		X6502_Run(16);
+		LINE_RUN(2, 16);
 		return;
 	}
 
-	int x;
-	uint8 *target = XBuf + ((scanline < 240 ? scanline : 240) << 8);
-	u8* dtarget = XDBuf + ((scanline < 240 ? scanline : 240) << 8);
-
 	if (MMC5Hack) MMC5_hb(scanline);
 
-	X6502_Run(256);
+	LINE_RUN(3, 256);
 	EndRL();
 
-	if (!renderbg) {// User asked to not display background data.
-		uint32 tem;
-		uint8 col;
-		if (gNoBGFillColor == 0xFF)
-			col = READPAL(0);
-		else col = gNoBGFillColor;
-		tem = col | (col << 8) | (col << 16) | (col << 24);
-		tem |= 0x40404040; 
-		FCEU_dwmemset(target, tem, 256);
-	}
+	//headless: none of the pixel work below
+	if (!headless) {
+		int x;
+		uint8 *target = XBuf + ((scanline < 240 ? scanline : 240) << 8);
+		u8* dtarget = XDBuf + ((scanline < 240 ? scanline : 240) << 8);
+
+		if (!renderbg) {// User asked to not display background data.
+			uint32 tem;
+			uint8 col;
+			if (gNoBGFillColor == 0xFF)
+				col = READPAL(0);
+			else col = gNoBGFillColor;
+			tem = col | (col << 8) | (col << 16) | (col << 24);
+			tem |= 0x40404040; 
+			FCEU_dwmemset(target, tem, 256);
+		}
 
-	if (SpriteON)
-		CopySprites(target);
+		if (SpriteON)
+			CopySprites(target);
 
-	//greyscale handling (mask some bits off the color) ? ? ?
-	if (ScreenON || SpriteON)
-	{
-		if (PPU[1] & 0x01) {
-			for (x = 63; x >= 0; x--)
-				*(uint32*)&target[x << 2] = (*(uint32*)&target[x << 2]) & 0x30303030;
+		//greyscale handling (mask some bits off the color) ? ? ?
+		if (ScreenON || SpriteON)
+		{
+			if (PPU[1] & 0x01) {
+				for (x = 63; x >= 0; x--)
+					*(uint32*)&target[x << 2] = (*(uint32*)&target[x << 2]) & 0x30303030;
+			}
 		}
-	}
 
-	//some pathetic attempts at deemph
-	if ((PPU[1] >> 5) == 0x7) {
-		for (x = 63; x >= 0; x--)
-			*(uint32*)&target[x << 2] = ((*(uint32*)&target[x << 2]) & 0x3f3f3f3f) | 0xc0c0c0c0;
-	} else if (PPU[1] & 0xE0)
-		for (x = 63; x >= 0; x--)
-			*(uint32*)&target[x << 2] = (*(uint32*)&target[x << 2]) | 0x40404040;
-	else
-		for (x = 63; x >= 0; x--)
-			*(uint32*)&target[x << 2] = ((*(uint32*)&target[x << 2]) & 0x3f3f3f3f) | 0x80808080;
+		//some pathetic attempts at deemph
+		if ((PPU[1] >> 5) == 0x7) {
+			for (x = 63; x >= 0; x--)
+				*(uint32*)&target[x << 2] = ((*(uint32*)&target[x << 2]) & 0x3f3f3f3f) | 0xc0c0c0c0;
+		} else if (PPU[1] & 0xE0)
+			for (x = 63; x >= 0; x--)
+				*(uint32*)&target[x << 2] = (*(uint32*)&target[x << 2]) | 0x40404040;
+		else
+			for (x = 63; x >= 0; x--)
+				*(uint32*)&target[x << 2] = ((*(uint32*)&target[x << 2]) & 0x3f3f3f3f) | 0x80808080;
 
-	//write the actual deemph
-	for (x = 63; x >= 0; x--)
-		*(uint32*)&dtarget[x << 2] = ((PPU[1]>>5)<<0)|((PPU[1]>>5)<<8)|((PPU[1]>>5)<<16)|((PPU[1]>>5)<<24);
+		//write the actual deemph
+		for (x = 63; x >= 0; x--)
+			*(uint32*)&dtarget[x << 2] = ((PPU[1]>>5)<<0)|((PPU[1]>>5)<<8)|((PPU[1]>>5)<<16)|((PPU[1]>>5)<<24);
+	}
 
 	sphitx = 0x100;
 
@@ -1360,15 +1453,15 @@ static void DoLine(void) {
 		FetchSpriteData();
 
 	if (GameHBIRQHook && (ScreenON || SpriteON) && ((PPU[0] & 0x38) != 0x18)) {
-		X6502_Run(6);
+		LINE_RUN(4, 6);
 		Fixit2();
-		X6502_Run(4);
+		LINE_RUN(5, 4);
 		GameHBIRQHook();
-		X6502_Run(85 - 16 - 10);
+		LINE_RUN(6, 85 - 16 - 10);
 	} else {
-		X6502_Run(6);	// Tried 65, caused problems with Slalom(maybe others)
+		LINE_RUN(7, 6);	// Tried 65, caused problems with Slalom(maybe others)
 		Fixit2();
-		X6502_Run(85 - 6 - 16);
+		LINE_RUN(8, 85 - 6 - 16);
 
 		// A semi-hack for Star Trek: 25th Anniversary
 		if (GameHBIRQHook && (ScreenON || SpriteON) && ((PPU[0] & 0x38) != 0x18))
@@ -1377,15 +1470,20 @@ static void DoLine(void) {
 
 	DEBUG(FCEUD_UpdateNTView(scanline, 0));
 
-	if (SpriteON)
-		RefreshSprites();
+	if (SpriteON) {
+		if (headless)
+			RefreshSprite0();
+		else
+			RefreshSprites();
+	}
 	if (GameHBIRQHook2 && (ScreenON || SpriteON))
 		GameHBIRQHook2();
 	scanline++;
 	if (scanline < 240) {
 		ResetRL(XBuf + (scanline << 8));
 	}
-	X6502_Run(16);
+	LINE_RUN(9, 16);
+	}
 }
 
 #define V_FLIP  0x80
@@ -1544,6 +1642,36 @@ static void FetchSpriteData(void) {
 	SpriteBlurp = sb;
 }
 
+//arm the sprite 0 hit check for the next line
+static INLINE void SetSprite0Hit(const SPRB *spr) {
+	uint8 J = spr->ca[0] | spr->ca[1];
+
+	sphitx = spr->x;
+	sphitdata = J;
+	if (spr->atr & H_FLIP)
+		sphitdata = ((J << 7) & 0x80) |
+					((J << 5) & 0x40) |
+					((J << 3) & 0x20) |
+					((J << 1) & 0x10) |
+					((J >> 1) & 0x08) |
+					((J >> 3) & 0x04) |
+					((J >> 5) & 0x02) |
+					((J >> 7) & 0x01);
+}
+
+//RefreshSprites() for headless mode: only the sprite 0 part, no sprite line buffer
+static void RefreshSprite0(void) {
+	spork = 0;
+	if (!numsprites) return;
+
+	numsprites--;
+	SPRB *spr = (SPRB*)SPRBUF;
+	if ((spr->ca[0] | spr->ca[1]) && SpriteBlurp && !(PPU_status & 0x40))
+		SetSprite0Hit(spr);
+
+	spork = 1;
+}
+
 static void RefreshSprites(void) {
 	int n;
 	SPRB *spr;
@@ -1568,19 +1696,8 @@ static void RefreshSprites(void) {
 		atr = spr->atr;
 
 		if (J) {
-			if (n == 0 && SpriteBlurp && !(PPU_status & 0x40)) {
-				sphitx = x;
-				sphitdata = J;
-				if (atr & H_FLIP)
-					sphitdata = ((J << 7) & 0x80) |
-								((J << 5) & 0x40) |
-								((J << 3) & 0x20) |
-								((J << 1) & 0x10) |
-								((J >> 1) & 0x08) |
-								((J >> 3) & 0x04) |
-								((J >> 5) & 0x02) |
-								((J >> 7) & 0x01);
-			}
+			if (n == 0 && SpriteBlurp && !(PPU_status & 0x40))
+				SetSprite0Hit(spr);
 
 			C = sprlinebuf + x;
 			VB = (0x10) + ((atr & 3) << 2);
@@ -1727,6 +1844,7 @@ void FCEUPPU_Power(void) {
 	memset(UPALRAM, 0x00, 0x03);
 	memset(SPRAM, 0x00, 0x100);
 	FCEUPPU_Reset();
+	FCEUPPU_AbortFrame();
 
 	for (x = 0x2000; x < 0x4000; x += 8) {
 		ARead[x] = A200x;
@@ -1755,13 +1873,19 @@ int FCEUPPU_Loop(int skip) {
 		return FCEUX_PPU_Loop(skip);
 	}
 
+	const int phase = ppu_phase;
+	ppu_phase = 0;
+	if (phase) X6502_Resume();
+	switch (phase) {
+	case 0:
+
 	//Needed for Knight Rider, possibly others.
 	if (ppudead) {
 		memset(XBuf, 0x80, 256 * 240);
-		X6502_Run(scanlines_per_frame * (256 + 85));
+		PPU_RUN(1, scanlines_per_frame * (256 + 85));
 		ppudead--;
 	} else {
-		X6502_Run(256 + 85);
+		PPU_RUN(2, 256 + 85);
 		PPU_status |= 0x80;
 
 		//Not sure if this is correct.  According to Matt Conte and my own tests, it is.
@@ -1770,23 +1894,23 @@ int FCEUPPU_Loop(int skip) {
 		PPU[3] = PPUSPL = 0;
 
 		//I need to figure out the true nature and length of this delay.
-		X6502_Run(12);
+		PPU_RUN(3, 12);
 		if (GameInfo->type == GIT_NSF)
 			DoNSFFrame();
 		else {
 			if (VBlankON)
 				TriggerNMI();
 		}
-		X6502_Run((scanlines_per_frame - 242) * (256 + 85) - 12);
+		PPU_RUN(4, (scanlines_per_frame - 242) * (256 + 85) - 12);
 		if (overclock_enabled && vblankscanlines) {
 			if (!DMC_7bit || !skip_7bit_overclocking) {
 				overclocking = 1;
-				X6502_Run(vblankscanlines * (256 + 85) - 12);
+				PPU_RUN(5, vblankscanlines * (256 + 85) - 12);
 				overclocking = 0;
 			}
 		}
 		PPU_status &= 0x1f;
-		X6502_Run(256);
+		PPU_RUN(6, 256);
 
 		{
 			int x;
@@ -1801,7 +1925,7 @@ int FCEUPPU_Loop(int skip) {
 				if (GameHBIRQHook2)
 					GameHBIRQHook2();
 			}
-			X6502_Run(85 - 16);
+			PPU_RUN(7, 85 - 16);
 			if (ScreenON || SpriteON) {
 				RefreshAddr = TempAddr;
 				if (PPU_hook) PPU_hook(RefreshAddr & 0x3fff);
@@ -1811,11 +1935,12 @@ int FCEUPPU_Loop(int skip) {
 			spork = numsprites = 0;
 			ResetRL(XBuf);
 
-			X6502_Run(16 - kook);
+			PPU_RUN(8, 16 - kook);
 			kook ^= 1;
 		}
-		if (GameInfo->type == GIT_NSF)
-			X6502_Run((256 + 85) * normalscanlines);
+		if (GameInfo->type == GIT_NSF) {
+			PPU_RUN(9, (256 + 85) * normalscanlines);
+		}
 		#ifdef FRAMESKIP
 		else if (skip) {
 			int y;
@@ -1855,7 +1980,12 @@ int FCEUPPU_Loop(int skip) {
 				if (scanline < 240)
 					DEBUG(FCEUD_UpdatePPUView(scanline, 1));
 
+	case 10:
 				DoLine();
+				if (X6502_Stopped()) {
+					ppu_phase = 10;
+					return -1;
+				}
 
 				if (scanline < normalscanlines || scanline == totalscanlines)
 					overclocking = 0;
@@ -1881,6 +2011,7 @@ int FCEUPPU_Loop(int skip) {
 			SetNESDeemph_OldHacky(maxref, 0);
 		}
 	}	//else... to if(ppudead)
+	}
 
 	#ifdef FRAMESKIP
 	if (skip) {
@@ -1900,6 +2031,9 @@ static uint16 TempAddrT, RefreshAddrT;
 void FCEUPPU_LoadState(int version) {
 	TempAddr = TempAddrT;
 	RefreshAddr = RefreshAddrT;
+	Pline = PlineT < 0 ? 0 : XBuf + PlineT;
+	Plinef = PlinefT < 0 ? 0 : XBuf + PlinefT;
+	X6502_RestoreStop(ppu_phase != 0, cpuHookDoneT);
 }
 
 SFORMAT FCEUPPU_STATEINFO[] = {
@@ -1916,6 +2050,33 @@ SFORMAT FCEUPPU_STATEINFO[] = {
 	{ &TempAddrT, 2 | FCEUSTATE_RLSB, "TADD" },
 	{ &VRAMBuffer, 1, "VBUF" },
 	{ &PPUGenLatch, 1, "PGEN" },
+	//frame position, see PlineT
+	{ &ppu_phase, 4 | FCEUSTATE_RLSB, "FPHA" },
+	{ &doline_phase, 4 | FCEUSTATE_RLSB, "LPHA" },
+	{ &scanline, 4 | FCEUSTATE_RLSB, "SCAN" },
+	{ &totalscanlines, 4 | FCEUSTATE_RLSB, "TSCN" },
+	{ &overclocking, sizeof(overclocking), "OCLK" },
+	{ &deemp, 1, "DEMP" },
+	{ &deempcnt[0], 4 | FCEUSTATE_RLSB, "DMC0" },
+	{ &deempcnt[1], 4 | FCEUSTATE_RLSB, "DMC1" },
+	{ &deempcnt[2], 4 | FCEUSTATE_RLSB, "DMC2" },
+	{ &deempcnt[3], 4 | FCEUSTATE_RLSB, "DMC3" },
+	{ &deempcnt[4], 4 | FCEUSTATE_RLSB, "DMC4" },
+	{ &deempcnt[5], 4 | FCEUSTATE_RLSB, "DMC5" },
+	{ &deempcnt[6], 4 | FCEUSTATE_RLSB, "DMC6" },
+	{ &deempcnt[7], 4 | FCEUSTATE_RLSB, "DMC7" },
+	{ &PlineT, 4 | FCEUSTATE_RLSB, "PLIN" },
+	{ &PlinefT, 4 | FCEUSTATE_RLSB, "PLNF" },
+	{ &firsttile, 4 | FCEUSTATE_RLSB, "FTIL" },
+	{ &linestartts, 4 | FCEUSTATE_RLSB, "LSTS" },
+	{ &tofix, 4 | FCEUSTATE_RLSB, "TFIX" },
+	{ &sphitx, 4 | FCEUSTATE_RLSB, "SPHX" },
+	{ &sphitdata, 1, "SPHD" },
+	{ &spork, 4 | FCEUSTATE_RLSB, "SPRK" },
+	{ &numsprites, 1, "NSPR" },
+	{ &SpriteBlurp, 1, "SBLR" },
+	{ SPRBUF, 0x100, "SPRB" },
+	{ &cpuHookDoneT, 4 | FCEUSTATE_RLSB, "CHKD" },
 	{ 0 }
 };
 
@@ -1957,6 +2118,9 @@ SFORMAT FCEU_NEWPPU_STATEINFO[] = {
 void FCEUPPU_SaveState(void) {
 	TempAddrT = TempAddr;
 	RefreshAddrT = RefreshAddr;
+	PlineT = Pline ? (int32)(Pline - XBuf) : -1;
+	PlinefT = Plinef ? (int32)(Plinef - XBuf) : -1;
+	cpuHookDoneT = X6502_HookDone();
 }
 
 uint32 FCEUPPU_PeekAddress()
@@ -1,7 +1,10 @@
 void FCEUPPU_Init(void);
 void FCEUPPU_Reset(void);
 void FCEUPPU_Power(void);
-int FCEUPPU_Loop(int skip);
+int FCEUPPU_Loop(int skip);  //-1: left mid-frame by X6502_Stop(), the next call resumes
+
+bool FCEUPPU_InFrame(void);  //a frame was left mid-way
+void FCEUPPU_AbortFrame(void);
 
 void FCEUPPU_LineUpdate();
 void FCEUPPU_SetVideoSystem(int w);
@@ -16,6 +19,15 @@ void newppu_hacky_emergency_reset();
 /* For cart.c and banksw.h, mostly */
 extern uint8 NTARAM[0x800], *vnapage[4];
 extern uint8 PPUNTARAM;
+
+//NTARAM granules (64 bytes, one bit each) written since the last raw savestate sync. see FCEUSS_LoadRaw()
+//vnapage[] may point elsewhere (ExtraNTARAM, CHR), so writes through it are marked by address.
+extern uint32 NTARAMDirty;
+static INLINE void FCEUPPU_MarkNTDirty(const uint8 *p)
+{
+	const uintptr_t ofs = (uintptr_t)p - (uintptr_t)NTARAM;
+	if(ofs < 0x800) NTARAMDirty |= 1u << (ofs >> 6);
+}
 extern uint8 PPUCHRRAM;
 
 void FCEUPPU_SaveState(void);
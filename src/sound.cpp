@@ -136,6 +136,11 @@ static char DMCHaveDMA=0;
 static uint8 DMCDMABuf=0;
 /*static*/ char DMCHaveSample=0;
 
+//silent mode: registers, length counters, $4015, the frame IRQ and DMC DMA/IRQ run exactly as usual,
+//but no samples are synthesized, mixed or filtered, whatever FSettings.SndRate says.
+static bool silent = false;
+#define SOUND_RENDERING (FSettings.SndRate && !silent)
+
 static void Dummyfunc(void) {};
 static void (*DoNoise)(void)=Dummyfunc;
 static void (*DoTriangle)(void)=Dummyfunc;
@@ -562,7 +567,7 @@ void FCEU_SoundCPUHook(int cycles)
    int t=((DMCShift&1)<<2)-2;
 
    /* Unbelievably ugly hack */
-   if(FSettings.SndRate)
+   if(SOUND_RENDERING)
    {
     soundtsoffs+=DMCacc;
     DoPCM();
@@ -1039,7 +1044,7 @@ int FlushEmulateSound(void)
 
   if(!soundtimestamp) return(0);
 
-  if(!FSettings.SndRate)
+  if(!SOUND_RENDERING)
   {
    left=0;
    end=0;
@@ -1218,7 +1223,7 @@ void SetSoundVariables(void)
   fhinc=PAL?16626:14915;  // *2 CPU clock rate
   fhinc*=24;
 
-  if(FSettings.SndRate)
+  if(SOUND_RENDERING)
   {
    wlookup1[0]=0;
    for(x=1;x<32;x++)
@@ -1276,6 +1281,44 @@ void FCEUI_Sound(int Rate)
 	SetSoundVariables();
 }
 
+void FCEUI_SetSoundSilent(bool on)
+{
+	silent=on;
+	SetSoundVariables();
+}
+
+bool FCEUI_GetSoundSilent()
+{
+	return silent;
+}
+
+void FCEUSND_GetVisible(FCEUSND_VISIBLE *v)
+{
+	int x;
+
+	//zeroed so that the padding compares equal too
+	memset(v,0,sizeof(*v));
+
+	v->status=SIRQStat;
+	for(x=0;x<4;x++) v->status|=lengthcount[x]?(1<<x):0;
+	if(DMCSize) v->status|=0x10;
+	v->irqFrameMode=IRQFrameMode;
+	v->frameStep=fcnt;
+	v->frameCycles=fhcnt;
+	for(x=0;x<4;x++) v->length[x]=lengthcount[x];
+
+	v->dmcAcc=DMCacc;
+	v->dmcPeriod=DMCPeriod;
+	v->dmcAddress=DMCAddress;
+	v->dmcSize=DMCSize;
+	v->dmcBitCount=DMCBitCount;
+	v->dmcShift=DMCShift;
+	v->dmcHaveDMA=DMCHaveDMA;
+	v->dmcDMABuf=DMCDMABuf;
+	v->dmcHaveSample=DMCHaveSample;
+	v->dmcFormat=DMCFormat;
+}
+
 void FCEUI_SetLowPass(int q)
 {
 	FSettings.lowpass=q;
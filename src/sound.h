@@ -70,6 +70,23 @@ void FCEUSND_SaveState(void);
 void FCEUSND_LoadState(int version);
 
 void FCEU_SoundCPUHook(int);
+
+//APU state the CPU can observe: $4015 as it would read (without the read side effect), the frame sequencer
+//and the DMC reader. synthesis-only state such as the noise LFSR is left out, so it is the same with and
+//without silent mode
+typedef struct {
+	uint8 status;
+	uint8 irqFrameMode;
+	uint8 frameStep;
+	int32 frameCycles;
+	int32 length[4];
+	int32 dmcAcc;
+	int32 dmcPeriod;
+	uint32 dmcAddress;
+	int32 dmcSize;
+	uint8 dmcBitCount, dmcShift, dmcHaveDMA, dmcDMABuf, dmcHaveSample, dmcFormat;
+} FCEUSND_VISIBLE;
+void FCEUSND_GetVisible(FCEUSND_VISIBLE *v);
 void Write_IRQFM (uint32 A, uint8 V); //mbg merge 7/17/06 brought over from latest mmbuild
 
 void LogDPCM(int romaddress, int dpcmsize);
@@ -57,6 +57,7 @@
 //#include <unistd.h> //mbg merge 7/17/06 removed
 
 #include <vector>
+#include <algorithm>
 #include <fstream>
 
 using namespace std;
@@ -122,6 +123,9 @@ SFORMAT SFCPUC[]={
 	{ &X.count,  4|RLSB, "ICou"},
 	{ &timestampbase, sizeof(timestampbase) | RLSB, "TSBS"},
 	{ &X.mooPI, 1, "MooP"}, // alternative to the "quick and dirty hack"
+	//cycles into the frame, nonzero only for a state saved mid-frame (see FCEUPPU_InFrame())
+	{ &timestamp, 4|RLSB, "TSTM"},
+	{ &soundtimestamp, 4|RLSB, "STSM"},
 	{ 0 }
 };
 
@@ -253,6 +257,9 @@ static bool ReadStateChunks(EMUFILE* is, int32 totalsize)
 	bool ret=true;
 	bool warned=false;
 
+	//states without the frame position were saved at a frame boundary
+	FCEUPPU_AbortFrame();
+
 	read_sfcpuc=0;
 	read_snd=0;
 
@@ -452,6 +459,317 @@ bool FCEUSS_SaveMS(EMUFILE* outstream, int compressionLevel)
 }
 
 
+//raw savestates.
+//the registered state regions are resolved once into a flat layout, and saving/loading is
+//a plain memcpy of each region: no chunk headers, no field lookup, no movie data and no back buffer.
+//a raw state is only meaningful in the session that made it (same game, same registered regions).
+struct RAWSS_REGION
+{
+	void *v;
+	uint32 size;
+	bool indirect;
+};
+
+static std::vector<RAWSS_REGION> rawss_layout;
+static uint32 rawss_size = 0;
+static bool rawss_layout_valid = false;
+
+//dirty tracking: id of the raw state the machine was last synced with (0 = none).
+//RAMDirty and NTARAMDirty hold the 64-byte granules written since then, so restoring
+//that same state again only needs to copy those granules back.
+static uint64 rawss_synced_id = 0;
+
+static void RawSS_Flatten(SFORMAT *sf, int count)
+{
+	for(int i=0; count<0 ? sf[i].v!=0 : i<count; i++)
+	{
+		if(sf[i].s==~0)		//Link to another struct
+		{
+			RawSS_Flatten((SFORMAT *)sf[i].v,-1);
+			continue;
+		}
+
+		RAWSS_REGION region;
+		region.v = sf[i].v;
+		region.size = sf[i].s&(~FCEUSTATE_FLAGS);
+		region.indirect = (sf[i].s&FCEUSTATE_INDIRECT)!=0;
+		if(!region.size) continue;
+
+		rawss_layout.push_back(region);
+		rawss_size += region.size;
+	}
+}
+
+static void RawSS_BuildLayout()
+{
+	rawss_layout.clear();
+	rawss_size = 0;
+
+	RawSS_Flatten(SFCPU,-1);
+	RawSS_Flatten(SFCPUC,-1);
+	RawSS_Flatten(FCEUPPU_STATEINFO,-1);
+	RawSS_Flatten(FCEU_NEWPPU_STATEINFO,-1);
+	RawSS_Flatten(FCEUCTRL_STATEINFO,-1);
+	RawSS_Flatten(FCEUSND_STATEINFO,-1);
+	RawSS_Flatten(FCEUMOV_STATEINFO,-1);
+	//SFMDATA isn't terminated after ResetExState(), so go by the index
+	RawSS_Flatten(SFMDATA,SFEXINDEX);
+
+	rawss_layout_valid = true;
+	rawss_synced_id = 0;
+}
+
+static INLINE uint8* RawSS_Ptr(const RAWSS_REGION &region)
+{
+	return region.indirect ? *(uint8 **)region.v : (uint8 *)region.v;
+}
+
+uint32 FCEUSS_RawSize()
+{
+	if(!rawss_layout_valid) RawSS_BuildLayout();
+	return rawss_size;
+}
+
+static void RawSS_Sync(uint64 id)
+{
+	rawss_synced_id = id;
+	RAMDirty = 0;
+	NTARAMDirty = 0;
+}
+
+//copy back the granules whose bit is set in dirty
+static void RawSS_RestoreDirty(uint8 *dst, const uint8 *src, uint32 dirty)
+{
+	for(uint32 ofs=0; dirty; ofs+=64, dirty>>=1)
+		if(dirty&1)
+			memcpy(dst+ofs,src+ofs,64);
+}
+
+void FCEUSS_InvalidateRawSync()
+{
+	rawss_synced_id = 0;
+}
+
+void FCEUSS_SaveRaw(uint8 *buf, uint64 id)
+{
+	if(!rawss_layout_valid) RawSS_BuildLayout();
+
+	FCEUPPU_SaveState();
+	FCEUSND_SaveState();
+
+	if(SPreSave) SPreSave();
+	for(size_t i=0; i<rawss_layout.size(); i++)
+	{
+		const RAWSS_REGION &region = rawss_layout[i];
+		memcpy(buf,RawSS_Ptr(region),region.size);
+		buf += region.size;
+	}
+	if(SPostSave) SPostSave();
+
+	//the machine now matches this state. without an id, keep tracking against the previous one.
+	if(id) RawSS_Sync(id);
+}
+
+//copy buf into the registered regions. when incremental, RAM and NTARAM only get their dirty granules.
+static void RawSS_CopyIn(const uint8 *buf, bool incremental)
+{
+	for(size_t i=0; i<rawss_layout.size(); i++)
+	{
+		const RAWSS_REGION &region = rawss_layout[i];
+		uint8 *p = RawSS_Ptr(region);
+		if(incremental && p==RAM && region.size==0x800)
+			RawSS_RestoreDirty(p,buf,RAMDirty);
+		else if(incremental && p==NTARAM && region.size==0x800)
+			RawSS_RestoreDirty(p,buf,NTARAMDirty);
+		else
+			memcpy(p,buf,region.size);
+		buf += region.size;
+	}
+}
+
+static void RawSS_PostLoad()
+{
+	//same as loading a state which has a sound chunk
+	extern int resetDMCacc;
+	resetDMCacc=0;
+
+	if(GameStateRestore)
+		GameStateRestore(FCEU_VERSION_NUMERIC);
+	FCEUPPU_LoadState(FCEU_VERSION_NUMERIC);
+	FCEUSND_LoadState(FCEU_VERSION_NUMERIC);
+}
+
+void FCEUSS_LoadRaw(const uint8 *buf, uint64 id)
+{
+	if(!rawss_layout_valid) RawSS_BuildLayout();
+
+	RawSS_CopyIn(buf, id && id==rawss_synced_id);
+	RawSS_Sync(id);
+
+	RawSS_PostLoad();
+}
+
+
+//raw state deltas.
+//a delta is a sequence of ops: varint skip, varint n, then n bytes of (child XOR parent).
+//skip counts bytes equal in both states. the last op has n==0 and just runs to the end.
+//equal gaps shorter than RAWDELTA_MIN_GAP are folded into the surrounding literal, since an op costs at least 2 bytes.
+#define RAWDELTA_MIN_GAP 4
+
+static INLINE uint8* RawDelta_PutVarint(uint8 *out, uint32 v)
+{
+	while(v >= 0x80)
+	{
+		*out++ = (uint8)(v|0x80);
+		v >>= 7;
+	}
+	*out++ = (uint8)v;
+	return out;
+}
+
+static INLINE bool RawDelta_GetVarint(const uint8 *&in, const uint8 *end, uint32 &v)
+{
+	v = 0;
+	for(int shift=0; shift<35; shift+=7)
+	{
+		if(in==end) return false;
+		const uint8 b = *in++;
+		v |= (uint32)(b&0x7F) << shift;
+		if(!(b&0x80)) return true;
+	}
+	return false;
+}
+
+//length of the run of equal bytes starting at pos
+static INLINE uint32 RawDelta_EqualRun(const uint8 *a, const uint8 *b, uint32 pos, uint32 size)
+{
+	uint32 i = pos;
+	for(; i+8<=size; i+=8)
+	{
+		uint64 x, y;
+		memcpy(&x,a+i,8);
+		memcpy(&y,b+i,8);
+		if(x!=y) break;
+	}
+	while(i<size && a[i]==b[i]) i++;
+	return i-pos;
+}
+
+uint32 FCEUSS_RawDeltaBound(uint32 size)
+{
+	//every op but the last covers at least RAWDELTA_MIN_GAP+1 bytes and costs at most two 5-byte varints
+	return size + 10*(size/(RAWDELTA_MIN_GAP+1) + 1);
+}
+
+uint32 FCEUSS_RawDeltaEncode(const uint8 *parent, const uint8 *child, uint32 size, uint8 *out)
+{
+	uint8 *const out_start = out;
+	uint32 pos = 0;
+	for(;;)
+	{
+		const uint32 skip = RawDelta_EqualRun(parent,child,pos,size);
+		const uint32 start = pos + skip;
+		if(start==size)
+		{
+			out = RawDelta_PutVarint(out,skip);
+			out = RawDelta_PutVarint(out,0);
+			break;
+		}
+
+		//extend the literal until a long enough equal run (or the end)
+		uint32 end = start+1;
+		for(;;)
+		{
+			while(end<size && parent[end]!=child[end]) end++;
+			if(end==size) break;
+			const uint32 gap = RawDelta_EqualRun(parent,child,end,size);
+			if(gap >= RAWDELTA_MIN_GAP || end+gap==size) break;
+			end += gap;
+		}
+
+		out = RawDelta_PutVarint(out,skip);
+		out = RawDelta_PutVarint(out,end-start);
+		for(uint32 i=start; i<end; i++)
+			*out++ = parent[i]^child[i];
+		pos = end;
+	}
+	return (uint32)(out-out_start);
+}
+
+//walk the ops of a delta, calling f(pos, xor bytes, n) for each literal. returns false on a malformed delta.
+template<class F>
+static bool RawDelta_Walk(const uint8 *delta, uint32 delta_size, uint32 size, F f)
+{
+	const uint8 *in = delta;
+	const uint8 *const end = delta + delta_size;
+	uint32 pos = 0;
+	for(;;)
+	{
+		uint32 skip, n;
+		if(!RawDelta_GetVarint(in,end,skip) || !RawDelta_GetVarint(in,end,n)) return false;
+		if(skip > size-pos) return false;
+		pos += skip;
+		if(n==0) return in==end;
+		if(n > size-pos || n > (uint32)(end-in)) return false;
+		f(pos,in,n);
+		pos += n;
+		in += n;
+	}
+}
+
+bool FCEUSS_RawDeltaDecode(const uint8 *parent, const uint8 *delta, uint32 delta_size, uint8 *child, uint32 size)
+{
+	memcpy(child,parent,size);
+	return RawDelta_Walk(delta,delta_size,size,[child](uint32 pos, const uint8 *x, uint32 n) {
+		for(uint32 i=0; i<n; i++)
+			child[pos+i] ^= x[i];
+	});
+}
+
+static INLINE void RawSS_MarkDirtyRange(uint32 &dirty, uint32 ofs, uint32 n)
+{
+	for(uint32 g=ofs>>6; g<=(ofs+n-1)>>6; g++)
+		dirty |= 1u << g;
+}
+
+bool FCEUSS_LoadRawDelta(const uint8 *parent, uint64 parent_id, const uint8 *delta, uint32 delta_size)
+{
+	if(!rawss_layout_valid) RawSS_BuildLayout();
+
+	RawSS_CopyIn(parent, parent_id && parent_id==rawss_synced_id);
+	RawSS_Sync(parent_id);
+
+	//patch the regions in place. ops come in increasing order, so the region cursor only moves forward.
+	size_t r = 0;
+	uint32 r_start = 0;
+	const bool ok = RawDelta_Walk(delta,delta_size,rawss_size,[&](uint32 pos, const uint8 *x, uint32 n) {
+		while(n)
+		{
+			while(pos >= r_start+rawss_layout[r].size)
+				r_start += rawss_layout[r++].size;
+			const uint32 k = std::min(n, r_start+rawss_layout[r].size-pos);
+			uint8 *base = RawSS_Ptr(rawss_layout[r]);
+			uint8 *p = base + (pos-r_start);
+			for(uint32 i=0; i<k; i++)
+				p[i] ^= x[i];
+			//the sync point stays at parent, so siblings can be loaded incrementally
+			if(base==RAM && rawss_layout[r].size==0x800)
+				RawSS_MarkDirtyRange(RAMDirty,pos-r_start,k);
+			else if(base==NTARAM && rawss_layout[r].size==0x800)
+				RawSS_MarkDirtyRange(NTARAMDirty,pos-r_start,k);
+			pos += k;
+			x += k;
+			n -= k;
+		}
+	});
+
+	//a bad delta leaves the machine somewhere between parent and child
+	if(!ok) FCEUSS_InvalidateRawSync();
+
+	RawSS_PostLoad();
+	return ok;
+}
+
 void FCEUSS_Save(const char *fname, bool display_message)
 {
 	EMUFILE* st = 0;
@@ -634,6 +952,9 @@ bool FCEUSS_LoadFP(EMUFILE* is, ENUM_SSLOADPARAMS params)
 {
 	if(!is) return false;
 
+	//the machine no longer matches any raw state
+	FCEUSS_InvalidateRawSync();
+
 	//maybe make a backup savestate
 	bool backup = (params == SSLOADPARAM_BACKUP);
 	EMUFILE_MEMORY msBackupSavestate;
@@ -856,6 +1177,7 @@ void ResetExState(void (*PreSave)(void), void (*PostSave)(void))
 	SPreSave = PreSave;
 	SPostSave = PostSave;
 	SFEXINDEX=0;
+	rawss_layout_valid = false;
 }
 
 void AddExState(void *v, uint32 s, int type, const char *desc)
@@ -892,6 +1214,7 @@ void AddExState(void *v, uint32 s, int type, const char *desc)
 		SFMDATA[SFEXINDEX].desc=0;
 	SFMDATA[SFEXINDEX].v=v;
 	SFMDATA[SFEXINDEX].s=s;
+	rawss_layout_valid = false;
 	if(type) SFMDATA[SFEXINDEX].s|=RLSB;
 	if(SFEXINDEX<SFMDATA_SIZE-1)
 		SFEXINDEX++;
@@ -32,6 +32,29 @@ bool FCEUSS_SaveMS(EMUFILE* outstream, int compressionLevel);
 
 bool FCEUSS_LoadFP(EMUFILE* is, ENUM_SSLOADPARAMS params);
 
+//raw in-memory savestates: a flat memcpy of every registered state region.
+//much faster than FCEUSS_SaveMS/FCEUSS_LoadFP, but only valid within the session that made them
+//and without movie data or the back buffer.
+//
+//id (nonzero) names the contents of buf; the caller must use a fresh id whenever those change.
+//loading the state the machine was last synced with (saved or loaded with the same id) copies
+//back only the RAM/NTARAM granules written since then. other regions are small and copied whole.
+uint32 FCEUSS_RawSize();
+void FCEUSS_SaveRaw(uint8 *buf, uint64 id=0);
+void FCEUSS_LoadRaw(const uint8 *buf, uint64 id=0);
+//forget the sync point, e.g. after RAM was rewritten behind the write handlers
+void FCEUSS_InvalidateRawSync();
+
+//raw state deltas: child XOR parent with the equal runs skipped. both states must have FCEUSS_RawSize() bytes.
+//FCEUSS_RawDeltaEncode() writes at most FCEUSS_RawDeltaBound(size) bytes to out and returns the length.
+//FCEUSS_LoadRawDelta() loads parent (incrementally if parent_id is the sync point) and patches the emulator
+//state in place. the sync point stays at parent with the patched granules marked dirty, so loading
+//several children of one parent in turn stays incremental. the decoders return false on a malformed delta.
+uint32 FCEUSS_RawDeltaBound(uint32 size);
+uint32 FCEUSS_RawDeltaEncode(const uint8 *parent, const uint8 *child, uint32 size, uint8 *out);
+bool FCEUSS_RawDeltaDecode(const uint8 *parent, const uint8 *delta, uint32 delta_size, uint8 *child, uint32 size);
+bool FCEUSS_LoadRawDelta(const uint8 *parent, uint64 parent_id, const uint8 *delta, uint32 delta_size);
+
 extern int CurrentState;
 void FCEUSS_CheckStates(void);
 
@@ -45,40 +45,82 @@ void (*MapIRQHook)(int a);
  if(!overclocking) soundtimestamp+=__x; \
 }
 
+//optional per-instruction work, see X6502_SetFeatures()
+static uint32 x6502_features = X6502_FEAT_ALL;
+
+//see X6502_Stop()
+static int x6502_stop = 0;
+static int x6502_hook_done = 0;  //the driver exec hook already ran for the instruction at _PC
+static uint64 x6502_stop_cycle = 0;
+
+//driver memory hooks, see X6502_SetMemHookMaps()
+static const uint64 x6502_nohooks[0x10000/64] = {0};
+static const uint64 *x6502_rdhooks = x6502_nohooks;
+static const uint64 *x6502_wrhooks = x6502_nohooks;
+static uint16 x6502_oppc; //address of the instruction being executed, for the memory hooks
+
+#define X6502_MEMHOOKED(map,A) (((map)[(A)>>6]>>((A)&63))&1)
+
 //normal memory read
-static INLINE uint8 RdMem(unsigned int A)
+template<uint32 FEATURES>
+static INLINE uint8 RdMemT(unsigned int A)
 {
- return(_DB=ARead[A](A));
+ _DB=ARead[A](A);
+ if((FEATURES & X6502_FEAT_MEM_HOOK) && X6502_MEMHOOKED(x6502_rdhooks,A))
+  FCEUD_CallHookOnRead(A,_DB,x6502_oppc);
+ return(_DB);
 }
 
 //normal memory write
-static INLINE void WrMem(unsigned int A, uint8 V)
+template<uint32 FEATURES>
+static INLINE void WrMemT(unsigned int A, uint8 V)
 {
 	BWrite[A](A,V);
 	#ifdef _S9XLUA_H
-	CallRegisteredLuaMemHook(A, 1, V, LUAMEMHOOK_WRITE);
+	if(FEATURES & X6502_FEAT_LUA)
+		CallRegisteredLuaMemHook(A, 1, V, LUAMEMHOOK_WRITE);
 	#endif
+	if((FEATURES & X6502_FEAT_MEM_HOOK) && X6502_MEMHOOKED(x6502_wrhooks,A))
+		FCEUD_CallHookOnWrite(A,V,x6502_oppc);
 }
 
-static INLINE uint8 RdRAM(unsigned int A)
+template<uint32 FEATURES>
+static INLINE uint8 RdRAMT(unsigned int A)
 {
   //bbit edited: this was changed so cheat substituion would work
-  return(_DB=ARead[A](A));
-  // return(_DB=RAM[A]);
+  _DB=ARead[A](A);
+  // _DB=RAM[A];
+  if((FEATURES & X6502_FEAT_MEM_HOOK) && X6502_MEMHOOKED(x6502_rdhooks,A))
+   FCEUD_CallHookOnRead(A,_DB,x6502_oppc);
+  return(_DB);
 }
 
-static INLINE void WrRAM(unsigned int A, uint8 V)
+template<uint32 FEATURES>
+static INLINE void WrRAMT(unsigned int A, uint8 V)
 {
 	RAM[A]=V;
+	FCEU_MARK_RAM_DIRTY(A);
 	#ifdef _S9XLUA_H
-	CallRegisteredLuaMemHook(A, 1, V, LUAMEMHOOK_WRITE);
+	if(FEATURES & X6502_FEAT_LUA)
+		CallRegisteredLuaMemHook(A, 1, V, LUAMEMHOOK_WRITE);
 	#endif
+	if((FEATURES & X6502_FEAT_MEM_HOOK) && X6502_MEMHOOKED(x6502_wrhooks,A))
+		FCEUD_CallHookOnWrite(A,V,x6502_oppc);
 }
 
+//the opcode macros below are only expanded inside X6502_RunLoop<FEATURES>()
+#define RdMem(A) RdMemT<FEATURES>(A)
+#define RdRAM(A) RdRAMT<FEATURES>(A)
+#define WrMem(A,V) WrMemT<FEATURES>(A,V)
+#define WrRAM(A,V) WrRAMT<FEATURES>(A,V)
+
 uint8 X6502_DMR(uint32 A)
 {
  ADDCYC(1);
- return(X.DB=ARead[A](A));
+ X.DB=ARead[A](A);
+ if((x6502_features & X6502_FEAT_MEM_HOOK) && X6502_MEMHOOKED(x6502_rdhooks,A))
+  FCEUD_CallHookOnRead(A,X.DB,x6502_oppc);
+ return(X.DB);
 }
 
 void X6502_DMW(uint32 A, uint8 V)
@@ -86,8 +128,17 @@ void X6502_DMW(uint32 A, uint8 V)
  ADDCYC(1);
  BWrite[A](A,V);
  #ifdef _S9XLUA_H
- CallRegisteredLuaMemHook(A, 1, V, LUAMEMHOOK_WRITE);
+ if(x6502_features & X6502_FEAT_LUA)
+  CallRegisteredLuaMemHook(A, 1, V, LUAMEMHOOK_WRITE);
  #endif
+ if((x6502_features & X6502_FEAT_MEM_HOOK) && X6502_MEMHOOKED(x6502_wrhooks,A))
+  FCEUD_CallHookOnWrite(A,V,x6502_oppc);
+}
+
+void X6502_SetMemHookMaps(const uint64 *read, const uint64 *write)
+{
+ x6502_rdhooks = read ? read : x6502_nohooks;
+ x6502_wrhooks = write ? write : x6502_nohooks;
 }
 
 #define PUSH(V) \
@@ -414,23 +465,27 @@ void X6502_Power(void)
  _S=0xFD;
  timestamp=soundtimestamp=0;
  X6502_Reset();
+ X6502_ClearStop();
  StackAddrBackup = -1;
 }
 
-void X6502_Run(int32 cycles)
+//the CPU loop, specialized for one feature set so that disabled features cost nothing per instruction
+template<uint32 FEATURES>
+static void X6502_RunLoop(void)
 {
-  if(PAL)
-   cycles*=15;    // 15*4=60
-  else
-   cycles*=16;    // 16*4=64
-
-  _count+=cycles;
-extern int test; test++;
   while(_count>0)
   {
    int32 temp;
    uint8 b1;
 
+   //stopped by a driver hook during the previous instruction
+   if((FEATURES & (X6502_FEAT_DRIVER_HOOK|X6502_FEAT_MEM_HOOK)) && x6502_stop)
+    return;
+
+   //interrupt pushes are reported at the interrupted instruction
+   if(FEATURES & X6502_FEAT_MEM_HOOK)
+    x6502_oppc=_PC;
+
    if(_IRQlow)
    {
     if(_IRQlow&FCEU_IQRESET)
@@ -485,10 +540,28 @@ extern int test; test++;
               //major speed hit.
    }
 
+   //the driver hook may stop the CPU before this instruction. it is not called again when the CPU resumes here
+   if(FEATURES & X6502_FEAT_DRIVER_HOOK)
+   {
+    if(x6502_hook_done)
+     x6502_hook_done=0;
+    else
+    {
+     FCEUD_CallHookBeforeExec(_PC);
+     if(x6502_stop)
+     {
+      x6502_hook_done=1;
+      return;
+     }
+    }
+   }
+
 	//will probably cause a major speed decrease on low-end systems
-   DEBUG( DebugCycle() );
+   if(FEATURES & X6502_FEAT_DEBUG)
+    DEBUG( DebugCycle() );
 
-   IncrementInstructionsCounters();
+   if(FEATURES & X6502_FEAT_COUNTERS)
+    IncrementInstructionsCounters();
 
    _PI=_P;
    b1=RdMem(_PC);
@@ -502,9 +575,9 @@ extern int test; test++;
    if (!overclocking)
     FCEU_SoundCPUHook(temp);
    #ifdef _S9XLUA_H
-   CallRegisteredLuaMemHook(_PC, 1, 0, LUAMEMHOOK_EXEC);
+   if(FEATURES & X6502_FEAT_LUA)
+    CallRegisteredLuaMemHook(_PC, 1, 0, LUAMEMHOOK_EXEC);
    #endif
-   FCEUD_CallHookBeforeExec(_PC);
    _PC++;
    switch(b1)
    {
@@ -513,6 +586,145 @@ extern int test; test++;
   }
 }
 
+typedef void (*X6502_LOOP)(void);
+
+#define X6502_LOOP_ENTRY(n) X6502_RunLoop<n>
+static const X6502_LOOP x6502_loops[X6502_FEAT_ALL+1] = {
+ X6502_LOOP_ENTRY(0x0), X6502_LOOP_ENTRY(0x1), X6502_LOOP_ENTRY(0x2), X6502_LOOP_ENTRY(0x3),
+ X6502_LOOP_ENTRY(0x4), X6502_LOOP_ENTRY(0x5), X6502_LOOP_ENTRY(0x6), X6502_LOOP_ENTRY(0x7),
+ X6502_LOOP_ENTRY(0x8), X6502_LOOP_ENTRY(0x9), X6502_LOOP_ENTRY(0xA), X6502_LOOP_ENTRY(0xB),
+ X6502_LOOP_ENTRY(0xC), X6502_LOOP_ENTRY(0xD), X6502_LOOP_ENTRY(0xE), X6502_LOOP_ENTRY(0xF),
+ X6502_LOOP_ENTRY(0x10), X6502_LOOP_ENTRY(0x11), X6502_LOOP_ENTRY(0x12), X6502_LOOP_ENTRY(0x13),
+ X6502_LOOP_ENTRY(0x14), X6502_LOOP_ENTRY(0x15), X6502_LOOP_ENTRY(0x16), X6502_LOOP_ENTRY(0x17),
+ X6502_LOOP_ENTRY(0x18), X6502_LOOP_ENTRY(0x19), X6502_LOOP_ENTRY(0x1A), X6502_LOOP_ENTRY(0x1B),
+ X6502_LOOP_ENTRY(0x1C), X6502_LOOP_ENTRY(0x1D), X6502_LOOP_ENTRY(0x1E), X6502_LOOP_ENTRY(0x1F),
+};
+#undef X6502_LOOP_ENTRY
+
+static bool x6502_running = false;
+static int32 x6502_count_stash = 0;
+
+void X6502_SetFeatures(uint32 features)
+{
+ features &= X6502_FEAT_ALL;
+ if(features == x6502_features) return;
+ x6502_features = features;
+
+ //called from inside the loop (e.g. a hook adding another hook): make the running loop stop after
+ //this instruction, and let X6502_Run() continue with the rest of the cycles in the new loop
+ if(x6502_running)
+ {
+  x6502_count_stash += _count;
+  _count = 0;
+ }
+}
+
+uint32 X6502_GetFeatures(void)
+{
+ return x6502_features;
+}
+
+//leaves the outermost loop, also when a hook throws: otherwise the flag would stay set and
+//every later X6502_SetFeatures() would stash budget that nothing consumes
+struct X6502_RunningGuard
+{
+ bool outer;
+ X6502_RunningGuard() : outer(!x6502_running) { x6502_running = true; }
+ ~X6502_RunningGuard()
+ {
+  if(!outer) return;
+  x6502_running = false;
+  x6502_count_stash = 0;
+ }
+};
+
+//runs the pending budget in _count until it is used up or the CPU is stopped
+static void X6502_Go(void)
+{
+  //re-entry (a hook calling back into the emulator) just runs in the current loop
+  const X6502_RunningGuard guard;
+  const bool outer = guard.outer;
+  for(;;)
+  {
+   //hold back the part of the budget beyond the stop cycle
+   int32 held = 0;
+   if(x6502_stop_cycle)
+   {
+    const uint64 now = timestampbase + timestamp;
+    if(now >= x6502_stop_cycle)
+     x6502_stop = 1;
+    else if((uint64)_count > (x6502_stop_cycle - now) * 48)
+    {
+     held = _count - (int32)((x6502_stop_cycle - now) * 48);
+     _count -= held;
+    }
+   }
+   if(!x6502_stop)
+    x6502_loops[x6502_features]();
+   _count += held;
+   if(x6502_stop_cycle && timestampbase + timestamp >= x6502_stop_cycle)
+    x6502_stop = 1;
+
+   if(!outer || !x6502_count_stash) break;
+   _count += x6502_count_stash;
+   x6502_count_stash = 0;
+   if(x6502_stop) break;
+  }
+}
+
+void X6502_Run(int32 cycles)
+{
+  if(PAL)
+   cycles*=15;    // 15*4=60
+  else
+   cycles*=16;    // 16*4=64
+
+  _count+=cycles;
+extern int test; test++;
+
+  //a stopped CPU only accumulates budget until X6502_Resume()
+  if(!x6502_stop)
+   X6502_Go();
+}
+
+void X6502_Stop(void)
+{
+ x6502_stop = 1;
+}
+
+int X6502_Stopped(void)
+{
+ return x6502_stop;
+}
+
+void X6502_Resume(void)
+{
+ x6502_stop = 0;
+ X6502_Go();
+}
+
+void X6502_ClearStop(void)
+{
+ x6502_stop = 0;
+ x6502_hook_done = 0;
+}
+
+int X6502_HookDone(void)
+{
+ return x6502_hook_done;
+}
+
+void X6502_RestoreStop(int stopped, int hook_done)
+{
+ x6502_stop = stopped;
+ x6502_hook_done = hook_done;
+}
+
+void X6502_SetStopCycle(uint64 cycle)
+{
+ x6502_stop_cycle = cycle;
+}
+
 //--------------------------
 //---Called from debuggers
 void FCEUI_NMI(void)
@@ -527,6 +739,7 @@ void FCEUI_IRQ(void)
 
 void FCEUI_GetIVectors(uint16 *reset, uint16 *irq, uint16 *nmi)
 {
+ const uint32 FEATURES = 0; //not a CPU access: no hooks
  fceuindbg=1;
 
  *reset=RdMem(0xFFFC);
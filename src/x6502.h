@@ -47,6 +47,34 @@ void X6502_Debug(void (*CPUHook)(X6502 *),
 //#endif
 void X6502_RunDebug(int32 cycles);
 #define X6502_Run(x) X6502_RunDebug(x)
+
+//optional per-instruction work in the CPU loop. X6502_Run() uses a loop compiled for exactly the enabled set,
+//so disabled features cost nothing. all are enabled by default; a front end which knows it needs
+//fewer (no debugger, no Lua) can switch them off. changes made while the CPU runs apply from the next instruction.
+#define X6502_FEAT_DEBUG        0x1  //DebugCycle(): breakpoints, code/data logging, trace logging
+#define X6502_FEAT_COUNTERS     0x2  //instruction counters shown by the debugger
+#define X6502_FEAT_LUA          0x4  //Lua exec/write memory hooks
+#define X6502_FEAT_DRIVER_HOOK  0x8  //FCEUD_CallHookBeforeExec()
+#define X6502_FEAT_MEM_HOOK     0x10 //FCEUD_CallHookOnRead()/FCEUD_CallHookOnWrite()
+#define X6502_FEAT_ALL          0x1F
+void X6502_SetFeatures(uint32 features);
+uint32 X6502_GetFeatures(void);
+
+//select the addresses whose reads/writes reach the driver memory hooks: bit (A&63) of word (A>>6), NULL for none.
+//the maps are not copied; they must stay valid (and may be modified in place) until replaced.
+void X6502_SetMemHookMaps(const uint64 *read, const uint64 *write);
+
+//stopping the CPU mid-frame. X6502_Stop() (from a driver hook) stops the CPU before the next instruction, or before
+//the hooked one when called from FCEUD_CallHookBeforeExec(); X6502_Run() then returns with the rest of its budget
+//pending and X6502_Resume() continues with it. the old PPU frame loop keeps its position across a stop (FCEUPPU_InFrame()).
+//X6502_SetStopCycle() stops at the first instruction boundary at or after the given timestampbase+timestamp (0: none).
+void X6502_Stop(void);
+int X6502_Stopped(void);
+void X6502_Resume(void);
+void X6502_ClearStop(void);  //forget a stop without resuming (the state was replaced)
+int X6502_HookDone(void);  //stopped by the exec hook: the hook does not run again for the instruction at PC
+void X6502_RestoreStop(int stopped, int hook_done);  //for savestates taken mid-frame
+void X6502_SetStopCycle(uint64 cycle);
 //------------
 
 extern uint32 timestamp;